@@ -0,0 +1,500 @@
+// Micro-benchmarks of the editor core. Every workload runs against every
+// backend and prints one JSON object per line to stdout, so that results
+// of different versions can be diffed and compared by scripts. A human
+// readable table goes to stderr.
+//
+// Allocations and copies are counted by wrapping malloc(), calloc(),
+// realloc(), memcpy() and memmove() at link time (see `make bench`), so
+// the editor core does not need to know that it is being measured. The
+// moved bytes are only an approximation: copies the compiler inlines are
+// never seen, and those of the other threads of the core (the index
+// workers, the loader, the save writer) are counted too.
+//
+// Usage: ./editor_bench [filter...]
+// Only the workloads whose names contain one of the filters are run. The
+// ones that write files of a gigabyte are only run when a filter names
+// them, e.g. `./editor_bench 1GB`.
+#define _DEFAULT_SOURCE // fileno(), mmap()
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/editor.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_memcpy(void *dst, const void *src, size_t size);
+void *__real_memmove(void *dst, const void *src, size_t size);
+
+static atomic_bool counting = false;
+static atomic_size_t counted_allocs = 0;
+static atomic_size_t counted_alloc_bytes = 0;
+static atomic_size_t counted_moved_bytes = 0;
+
+static void count_alloc(size_t size)
+{
+    if (atomic_load_explicit(&counting, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&counted_allocs, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counted_alloc_bytes, size, memory_order_relaxed);
+    }
+}
+
+static void count_moved(size_t size)
+{
+    if (atomic_load_explicit(&counting, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&counted_moved_bytes, size, memory_order_relaxed);
+    }
+}
+
+void *__wrap_malloc(size_t size)
+{
+    count_alloc(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    count_alloc(count*size);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    count_alloc(size);
+    return __real_realloc(ptr, size);
+}
+
+void *__wrap_memcpy(void *dst, const void *src, size_t size)
+{
+    count_moved(size);
+    return __real_memcpy(dst, src, size);
+}
+
+void *__wrap_memmove(void *dst, const void *src, size_t size)
+{
+    count_moved(size);
+    return __real_memmove(dst, src, size);
+}
+
+typedef struct {
+    Editor_Backend backend;
+    const char *name;
+} Bench_Backend;
+
+static const Bench_Backend bench_backends[] = {
+    {EDITOR_BACKEND_LINES, "lines"},
+    {EDITOR_BACKEND_PIECE_TABLE, "piece_table"},
+    {EDITOR_BACKEND_ROPE, "rope"},
+};
+#define BENCH_BACKENDS_COUNT (sizeof(bench_backends)/sizeof(bench_backends[0]))
+
+static double bench_start_secs = 0.0;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void bench_start(void)
+{
+    atomic_store(&counted_allocs, 0);
+    atomic_store(&counted_alloc_bytes, 0);
+    atomic_store(&counted_moved_bytes, 0);
+    atomic_store(&counting, true);
+    bench_start_secs = now_secs();
+}
+
+// Workloads that push bytes through also report their throughput, along
+// with the throughput they are measured against, in MB/s
+static void bench_stop_bytes(const char *name, const Bench_Backend *backend, size_t ops,
+                             size_t bytes, double target_secs)
+{
+    const double secs = now_secs() - bench_start_secs;
+    atomic_store(&counting, false);
+
+    const double ns_per_op = secs*1e9/ops;
+    const double allocs_per_op = (double) atomic_load(&counted_allocs)/ops;
+    const double alloc_bytes_per_op = (double) atomic_load(&counted_alloc_bytes)/ops;
+    const double moved_bytes_per_op = (double) atomic_load(&counted_moved_bytes)/ops;
+
+    printf("{\"name\": \"%s\", \"backend\": \"%s\", \"ops\": %zu, "
+           "\"ns_per_op\": %.1f, \"allocs_per_op\": %.3f, "
+           "\"alloc_bytes_per_op\": %.1f, \"moved_bytes_per_op\": %.1f",
+           name, backend->name, ops, ns_per_op, allocs_per_op,
+           alloc_bytes_per_op, moved_bytes_per_op);
+    if (bytes > 0) {
+        printf(", \"mb_per_s\": %.1f, \"target_mb_per_s\": %.1f",
+               bytes*ops/secs*1e-6, bytes/target_secs*1e-6);
+    }
+    printf("}\n");
+    fflush(stdout);
+    fprintf(stderr, "%-16s %-12s %8zu ops %14.1f ns/op %10.3f allocs/op %14.1f B alloc/op %14.1f B moved/op",
+            name, backend->name, ops, ns_per_op, allocs_per_op,
+            alloc_bytes_per_op, moved_bytes_per_op);
+    if (bytes > 0) {
+        fprintf(stderr, " %8.1f MB/s (target %.1f MB/s)", bytes*ops/secs*1e-6, bytes/target_secs*1e-6);
+    }
+    fprintf(stderr, "\n");
+}
+
+static void bench_stop(const char *name, const Bench_Backend *backend, size_t ops)
+{
+    bench_stop_bytes(name, backend, ops, 0, 0.0);
+}
+
+// TYPING //
+
+#define LONG_LINE_SIZE (64*1024)
+#define TYPING_OPS 50000
+#define PASTE_SIZE (1024*1024)
+#define UNDO_OPS 100
+
+// One line of LONG_LINE_SIZE characters with the cursor at `col`
+static void bench_make_long_line(Editor *editor, size_t col)
+{
+    char *text = malloc(LONG_LINE_SIZE + 1);
+    memset(text, 'a', LONG_LINE_SIZE);
+    text[LONG_LINE_SIZE] = '\0';
+    editor_insert_text_before_cursor(editor, text);
+    free(text);
+    editor->cursor_row = 0;
+    editor->cursor_col = col;
+}
+
+static void bench_type(const char *name, const Bench_Backend *backend, size_t col)
+{
+    Editor editor = {.backend = backend->backend};
+    bench_make_long_line(&editor, col);
+
+    bench_start();
+    for (size_t i = 0; i < TYPING_OPS; ++i) {
+        editor_insert_text_before_cursor(&editor, "x");
+    }
+    bench_stop(name, backend, TYPING_OPS);
+
+    editor_free(&editor);
+}
+
+static void bench_type_start(const Bench_Backend *backend)
+{
+    bench_type("type_start", backend, 0);
+}
+
+static void bench_type_middle(const Bench_Backend *backend)
+{
+    bench_type("type_middle", backend, LONG_LINE_SIZE/2);
+}
+
+static void bench_type_end(const Bench_Backend *backend)
+{
+    bench_type("type_end", backend, LONG_LINE_SIZE);
+}
+
+static void bench_backspace(const Bench_Backend *backend)
+{
+    Editor editor = {.backend = backend->backend};
+    bench_make_long_line(&editor, LONG_LINE_SIZE/2);
+
+    bench_start();
+    for (size_t i = 0; i < TYPING_OPS/2; ++i) {
+        editor_backspace(&editor);
+    }
+    bench_stop("backspace", backend, TYPING_OPS/2);
+
+    editor_free(&editor);
+}
+
+// Undoing and redoing a 1MB paste into the middle of a long line, which
+// should cost about the size of the paste and not of the document
+static void bench_undo_paste(const Bench_Backend *backend)
+{
+    Editor editor = {.backend = backend->backend};
+    bench_make_long_line(&editor, LONG_LINE_SIZE/2);
+    char *paste = malloc(PASTE_SIZE + 1);
+    memset(paste, 'p', PASTE_SIZE);
+    paste[PASTE_SIZE] = '\0';
+    editor_insert_text_before_cursor(&editor, paste);
+    free(paste);
+
+    bench_start();
+    for (size_t i = 0; i < UNDO_OPS; ++i) {
+        editor_undo(&editor);
+        editor_redo(&editor);
+    }
+    bench_stop("undo_redo_1MB_paste", backend, UNDO_OPS*2);
+
+    editor_free(&editor);
+}
+
+// FILES //
+
+#define LARGE_FILE_LINES (1000*1000)
+#define ENTER_OPS 200
+
+// Lines of 0 to 80 printable characters
+static void bench_generate_file(const char *path, size_t size)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: could not create %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    char line[82];
+    size_t written = 0;
+    unsigned int seed = 69;
+    while (written < size) {
+        size_t n = rand_r(&seed)%81;
+        for (size_t i = 0; i < n; ++i) {
+            line[i] = 'a' + rand_r(&seed)%26;
+        }
+        line[n++] = '\n';
+        if (n > size - written) {
+            n = size - written;
+        }
+        fwrite(line, 1, n, file);
+        written += n;
+    }
+    fclose(file);
+}
+
+static void bench_temp_path(char *path, size_t path_size, const char *name)
+{
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, path_size, "%s/broadnick_bench_%s.txt", dir ? dir : "/tmp", name);
+}
+
+static void bench_load(const Bench_Backend *backend, const char *name, const char *size_name, size_t size)
+{
+    char path[1024];
+    bench_temp_path(path, sizeof(path), size_name);
+    bench_generate_file(path, size);
+
+    Editor editor = {.backend = backend->backend};
+    bench_start();
+    FILE *file = fopen(path, "r");
+    editor_load_from_file(&editor, file);
+    editor_load_wait(&editor);
+    fclose(file);
+    bench_stop(name, backend, 1);
+
+    editor_free(&editor);
+    remove(path);
+}
+
+static void bench_load_1mb(const Bench_Backend *backend)
+{
+    bench_load(backend, "load_1MB", "1MB", 1024*1024);
+}
+
+static void bench_load_100mb(const Bench_Backend *backend)
+{
+    bench_load(backend, "load_100MB", "100MB", 100*1024*1024);
+}
+
+static void bench_load_1gb(const Bench_Backend *backend)
+{
+    bench_load(backend, "load_1GB", "1GB", 1024*1024*1024);
+}
+
+#define FIRST_SCREEN_LINES 100
+
+// How long it takes until the first screen of a big file can be shown,
+// which is what the window waits for instead of the whole load
+static void bench_load_first_screen(const Bench_Backend *backend)
+{
+    char path[1024];
+    bench_temp_path(path, sizeof(path), "1GB");
+    bench_generate_file(path, 1024*1024*1024);
+
+    Editor editor = {.backend = backend->backend};
+    bench_start();
+    FILE *file = fopen(path, "r");
+    editor_load_from_file(&editor, file);
+    fclose(file);
+    while (editor_line_count(&editor) < FIRST_SCREEN_LINES && editor_load_poll(&editor)) {
+        usleep(100);
+    }
+    bench_stop("load_1GB_first_screen", backend, 1);
+
+    editor_load_wait(&editor);
+    editor_free(&editor);
+    remove(path);
+}
+
+static void bench_enter(const Bench_Backend *backend)
+{
+    char path[1024];
+    bench_temp_path(path, sizeof(path), "enter");
+    FILE *file = fopen(path, "w");
+    for (size_t i = 0; i < LARGE_FILE_LINES; ++i) {
+        fputs("The quick brown fox jumps over the lazy dog\n", file);
+    }
+    fclose(file);
+
+    Editor editor = {.backend = backend->backend};
+    file = fopen(path, "r");
+    editor_load_from_file(&editor, file);
+    editor_load_wait(&editor);
+    fclose(file);
+    editor.cursor_row = LARGE_FILE_LINES/2;
+    editor.cursor_col = 0;
+
+    bench_start();
+    for (size_t i = 0; i < ENTER_OPS; ++i) {
+        editor_insert_new_line(&editor);
+    }
+    bench_stop("enter_1M_lines", backend, ENTER_OPS);
+
+    editor_free(&editor);
+    remove(path);
+}
+
+// SAVING //
+
+#define SAVE_FILE_SIZE (100*1024*1024)
+#define SAVE_EDIT_EVERY 1000
+
+// Copying the file with cp is as fast as a save could possibly be. Like
+// the save, it replaces a file that already exists.
+static double bench_cp_secs(const char *src, const char *dst)
+{
+    char command[4096];
+    snprintf(command, sizeof(command), "cp --reflink=never '%s' '%s'", src, dst);
+    const double start = now_secs();
+    if (system(command) != 0) {
+        fprintf(stderr, "ERROR: could not run `%s`\n", command);
+        exit(1);
+    }
+    return now_secs() - start;
+}
+
+static void bench_save(const Bench_Backend *backend, const char *name, bool edited)
+{
+    char path[1024];
+    char save_path[1024];
+    bench_temp_path(path, sizeof(path), "save");
+    bench_temp_path(save_path, sizeof(save_path), "saved");
+    bench_generate_file(path, SAVE_FILE_SIZE);
+
+    Editor editor = {.backend = backend->backend};
+    FILE *file = fopen(path, "r");
+    editor_load_from_file(&editor, file);
+    editor_load_wait(&editor);
+    fclose(file);
+    if (edited) {
+        for (size_t row = 0; row < editor_line_count(&editor); row += SAVE_EDIT_EVERY) {
+            editor.cursor_row = row;
+            editor.cursor_col = 0;
+            editor_insert_text_before_cursor(&editor, "x");
+        }
+    }
+    // How fast the data gets to the disk is not up to the editor
+    editor.save_fsync = SAVE_FSYNC_NONE;
+
+    bench_cp_secs(path, save_path);
+    const double cp_secs = bench_cp_secs(path, save_path);
+    bench_start();
+    editor_save_to_file(&editor, save_path);
+    struct stat st;
+    const size_t size = stat(save_path, &st) == 0 ? (size_t) st.st_size : 0;
+    bench_stop_bytes(name, backend, 1, size, cp_secs);
+
+    editor_free(&editor);
+    remove(path);
+    remove(save_path);
+}
+
+static void bench_save_100mb(const Bench_Backend *backend)
+{
+    bench_save(backend, "save_100MB", false);
+}
+
+static void bench_save_100mb_edited(const Bench_Backend *backend)
+{
+    bench_save(backend, "save_100MB_edited", true);
+}
+
+// A few characters typed near the end of a big file, saved over the file
+// itself. With `save_in_place` the lines backend only writes the changed
+// tail back in place.
+static void bench_save_100mb_tail(const Bench_Backend *backend)
+{
+    char path[1024];
+    bench_temp_path(path, sizeof(path), "save");
+    bench_generate_file(path, SAVE_FILE_SIZE);
+
+    Editor editor = {.backend = backend->backend};
+    FILE *file = fopen(path, "r");
+    editor_load_from_file(&editor, file);
+    editor_load_wait(&editor);
+    fclose(file);
+    editor.cursor_row = editor_line_count(&editor) - 10;
+    editor.cursor_col = 0;
+    editor_insert_text_before_cursor(&editor, "hello");
+    editor.save_fsync = SAVE_FSYNC_NONE;
+    editor.save_in_place = true;
+
+    bench_start();
+    editor_save_to_file(&editor, path);
+    bench_stop("save_100MB_tail_edit", backend, 1);
+
+    editor_free(&editor);
+    remove(path);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(const Bench_Backend *backend);
+    // Too much for every run, see bench_selected()
+    bool huge;
+} Bench_Workload;
+
+static const Bench_Workload bench_workloads[] = {
+    {"type_start", bench_type_start, false},
+    {"type_middle", bench_type_middle, false},
+    {"type_end", bench_type_end, false},
+    {"backspace", bench_backspace, false},
+    {"undo_redo_1MB_paste", bench_undo_paste, false},
+    {"enter_1M_lines", bench_enter, false},
+    {"load_1MB", bench_load_1mb, false},
+    {"load_100MB", bench_load_100mb, false},
+    {"load_1GB", bench_load_1gb, true},
+    {"load_1GB_first_screen", bench_load_first_screen, true},
+    {"save_100MB", bench_save_100mb, false},
+    {"save_100MB_edited", bench_save_100mb_edited, false},
+    {"save_100MB_tail_edit", bench_save_100mb_tail, false},
+};
+#define BENCH_WORKLOADS_COUNT (sizeof(bench_workloads)/sizeof(bench_workloads[0]))
+
+static bool bench_selected(const Bench_Workload *workload, int argc, char **argv)
+{
+    if (argc <= 1) {
+        return !workload->huge;
+    }
+    for (int i = 1; i < argc; ++i) {
+        if (strstr(workload->name, argv[i]) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    for (size_t i = 0; i < BENCH_WORKLOADS_COUNT; ++i) {
+        if (!bench_selected(&bench_workloads[i], argc, argv)) {
+            continue;
+        }
+        for (size_t j = 0; j < BENCH_BACKENDS_COUNT; ++j) {
+            bench_workloads[i].run(&bench_backends[j]);
+        }
+    }
+    return 0;
+}
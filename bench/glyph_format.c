@@ -0,0 +1,98 @@
+// Compares how many bytes a frame of glyph instances takes and how long
+// it takes to build and copy it out in the old float Glyph layout and in
+// the packed one from glyph.h. The copy stands in for the upload to the
+// GPU, which is bound by the same bytes.
+#define _POSIX_C_SOURCE 199309L // clock_gettime()
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <GL/gl.h>
+
+#define VEC_IMPLEMENTATION
+#include "../src/vec.h"
+
+#include "../src/glyph.h"
+
+#define SCREEN_WIDTH 3840
+#define SCREEN_HEIGHT 2160
+#define FRAMES 200
+
+// The layout glyph.h used before the instances were packed
+typedef struct {
+    Vec2f pos;
+    float scale;
+    float ch;
+    Vec4f color;
+} Float_Glyph;
+
+static double now_secs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int main(void)
+{
+    const float scale = 1.0f;
+    const size_t cols = (size_t) (SCREEN_WIDTH/(FONT_CHAR_WIDTH*scale));
+    const size_t rows = (size_t) (SCREEN_HEIGHT/(FONT_CHAR_HEIGHT*scale));
+    const size_t count = cols*rows;
+
+    Float_Glyph *float_glyphs = malloc(count*sizeof(Float_Glyph));
+    Glyph *packed_glyphs = malloc(count*sizeof(Glyph));
+    char *upload = malloc(count*sizeof(Float_Glyph));
+    const Vec4f white = {.x = 1.0f, .y = 1.0f, .z = 1.0f, .t = 1.0f};
+
+    double start = now_secs();
+    for (size_t frame = 0; frame < FRAMES; ++frame) {
+        for (size_t i = 0; i < count; ++i) {
+            float_glyphs[i] = (Float_Glyph) {
+                .pos = {
+                    .x = (i%cols)*FONT_CHAR_WIDTH*scale,
+                    .y = (i/cols)*FONT_CHAR_HEIGHT*scale,
+                },
+                .scale = scale,
+                .ch = (float) ('a' + (i + frame)%26),
+                .color = white,
+            };
+        }
+        memcpy(upload, float_glyphs, count*sizeof(Float_Glyph));
+    }
+    const double float_secs = (now_secs() - start)/FRAMES;
+
+    start = now_secs();
+    for (size_t frame = 0; frame < FRAMES; ++frame) {
+        for (size_t i = 0; i < count; ++i) {
+            packed_glyphs[i] = (Glyph) {
+                .col = (int16_t) (i%cols),
+                .row = (int16_t) (i/cols),
+                .ch = (uint8_t) ('a' + (i + frame)%26),
+                .color = GLYPH_COLOR_TEXT,
+            };
+        }
+        memcpy(upload, packed_glyphs, count*sizeof(Glyph));
+    }
+    const double packed_secs = (now_secs() - start)/FRAMES;
+
+    // Keeps the copies from being optimized away
+    volatile char sink = upload[count - 1];
+    (void) sink;
+
+    printf("%zux%zu cells, %zu glyphs per frame\n", cols, rows, count);
+    printf("float  glyph: %2zu bytes, %8.1f KB/frame, %7.3f ms/frame, %5.2f ns/glyph\n",
+           sizeof(Float_Glyph), count*sizeof(Float_Glyph)/1024.0,
+           float_secs*1e3, float_secs*1e9/count);
+    printf("packed glyph: %2zu bytes, %8.1f KB/frame, %7.3f ms/frame, %5.2f ns/glyph\n",
+           sizeof(Glyph), count*sizeof(Glyph)/1024.0,
+           packed_secs*1e3, packed_secs*1e9/count);
+    printf("upload bytes are %.1fx smaller\n", (double) sizeof(Float_Glyph)/sizeof(Glyph));
+
+    free(float_glyphs);
+    free(packed_glyphs);
+    free(upload);
+    return 0;
+}
@@ -0,0 +1,182 @@
+// Replays a trace recorded with `./broadnick --record <trace>` against the
+// editor core without opening a window, and reports how long the editor
+// took to process each event. A session that felt sluggish can be turned
+// into a repeatable test this way.
+//
+// Usage: ./editor_replay [--realtime] [--file <path>] <trace>
+//   --realtime     wait between the events as long as the user did,
+//                  instead of replaying them as fast as possible
+//   --file <path>  load this file instead of the one that was recorded
+//
+// The file is loaded completely before the first event. Saves are written
+// to a temporary file, so the original is never touched.
+#define _DEFAULT_SOURCE // clock_nanosleep()
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/editor.h"
+#include "../src/trace.h"
+
+#define REPLAY_INIT_CAPACITY 1024
+
+static const char *const replay_backend_names[] = {
+    [EDITOR_BACKEND_LINES] = "lines",
+    [EDITOR_BACKEND_PIECE_TABLE] = "piece_table",
+    [EDITOR_BACKEND_ROPE] = "rope",
+};
+#define REPLAY_BACKENDS_COUNT (sizeof(replay_backend_names)/sizeof(replay_backend_names[0]))
+
+typedef struct {
+    uint64_t *items;
+    size_t count;
+    size_t capacity;
+} Latencies;
+
+static void latencies_push(Latencies *latencies, uint64_t ns)
+{
+    if (latencies->count >= latencies->capacity) {
+        size_t new_capacity = latencies->capacity;
+        if (new_capacity == 0) {
+            new_capacity = REPLAY_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+        latencies->items = realloc(latencies->items, new_capacity*sizeof(latencies->items[0]));
+        latencies->capacity = new_capacity;
+    }
+    latencies->items[latencies->count++] = ns;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t*) a;
+    const uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted latencies
+static uint64_t latencies_percentile(const Latencies *latencies, size_t percent)
+{
+    if (latencies->count == 0) {
+        return 0;
+    }
+    size_t rank = (latencies->count*percent + 99)/100;
+    if (rank == 0) {
+        rank = 1;
+    }
+    return latencies->items[rank - 1];
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+    const struct timespec ts = {
+        .tv_sec = deadline/1000000000,
+        .tv_nsec = deadline%1000000000,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {}
+}
+
+static void usage(FILE *stream)
+{
+    fprintf(stream, "Usage: ./editor_replay [--realtime] [--file <path>] <trace>\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool realtime = false;
+    const char *file_path = NULL;
+    const char *trace_path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+            file_path = argv[++i];
+        } else if (trace_path == NULL) {
+            trace_path = argv[i];
+        } else {
+            usage(stderr);
+            return 1;
+        }
+    }
+    if (trace_path == NULL) {
+        usage(stderr);
+        return 1;
+    }
+
+    Trace_Reader reader;
+    if (!trace_reader_open(&reader, trace_path)) {
+        return 1;
+    }
+    if ((size_t) reader.backend >= REPLAY_BACKENDS_COUNT) {
+        fprintf(stderr, "ERROR: %s: unknown backend %d\n", trace_path, reader.backend);
+        return 1;
+    }
+    if (file_path == NULL) {
+        file_path = reader.file_path;
+    }
+
+    Editor editor = {.backend = reader.backend};
+    if (file_path) {
+        FILE *file = fopen(file_path, "r");
+        if (file == NULL) {
+            fprintf(stderr, "ERROR: could not open %s: %s\n", file_path, strerror(errno));
+            return 1;
+        }
+        editor_load_from_file(&editor, file);
+        editor_load_wait(&editor);
+        fclose(file);
+    }
+
+    char save_path[1024];
+    const char *dir = getenv("TMPDIR");
+    snprintf(save_path, sizeof(save_path), "%s/broadnick_replay.txt", dir ? dir : "/tmp");
+
+    Latencies latencies = {0};
+    uint64_t busy_ns = 0;
+    const uint64_t start = now_ns();
+    Trace_Event event;
+    while (trace_read(&reader, &event)) {
+        if (realtime) {
+            sleep_until_ns(start + event.time_us*1000);
+        }
+        const uint64_t begin = now_ns();
+        trace_apply(&editor, &event, file_path ? save_path : NULL);
+        const uint64_t ns = now_ns() - begin;
+        latencies_push(&latencies, ns);
+        busy_ns += ns;
+    }
+    const uint64_t wall_ns = now_ns() - start;
+
+    qsort(latencies.items, latencies.count, sizeof(latencies.items[0]), compare_u64);
+    const uint64_t p50 = latencies_percentile(&latencies, 50);
+    const uint64_t p99 = latencies_percentile(&latencies, 99);
+    const uint64_t max = latencies.count > 0 ? latencies.items[latencies.count - 1] : 0;
+    const double events_per_sec = busy_ns > 0 ? latencies.count*1e9/busy_ns : 0.0;
+
+    printf("{\"trace\": \"%s\", \"backend\": \"%s\", \"realtime\": %s, \"events\": %zu, "
+           "\"p50_ns\": %lu, \"p99_ns\": %lu, \"max_ns\": %lu, "
+           "\"busy_ms\": %.3f, \"wall_ms\": %.3f, \"events_per_sec\": %.1f}\n",
+           trace_path, replay_backend_names[reader.backend], realtime ? "true" : "false",
+           latencies.count, (unsigned long) p50, (unsigned long) p99, (unsigned long) max,
+           busy_ns*1e-6, wall_ns*1e-6, events_per_sec);
+    fprintf(stderr, "%zu events on %s: p50 %.1f us, p99 %.1f us, max %.1f us, %.1f events/s (%.3f ms busy, %.3f ms wall)\n",
+            latencies.count, replay_backend_names[reader.backend],
+            p50*1e-3, p99*1e-3, max*1e-3, events_per_sec, busy_ns*1e-6, wall_ns*1e-6);
+
+    free(latencies.items);
+    editor_free(&editor);
+    trace_reader_close(&reader);
+    remove(save_path);
+    return 0;
+}
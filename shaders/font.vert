@@ -6,28 +6,57 @@
 #define FONT_COLS 18
 #define FONT_CHAR_WIDTH (FONT_WIDTH / FONT_COLS)
 #define FONT_CHAR_HEIGHT (FONT_HEIGHT / FONT_ROWS)
+#define FONT_CHAR_WIDTH_UV (float(FONT_CHAR_WIDTH) / FONT_WIDTH)
+#define FONT_CHAR_HEIGHT_UV (float(FONT_CHAR_HEIGHT) / FONT_HEIGHT)
+
+// Keep in sync with glyph.h. Text never comes with GLYPH_SOLID, since
+// ogl_render_text() turns the bytes outside of the display range into '?'.
+#define ASCII_DISPLAY_LOW 32
+#define ASCII_DISPLAY_HIGH 126
+#define GLYPH_SOLID 127
+#define COUNT_GLYPH_COLORS 8
 
 uniform vec2 resolution;
+// Where the top left corner of cell (0, 0) is on the screen
+uniform vec2 origin;
+uniform vec2 cell_size;
+uniform vec4 palette[COUNT_GLYPH_COLORS];
+// Computed once per frame, applied to the text but not to solid glyphs
+uniform vec4 tint;
 
-layout(location = 0) in vec2 pos;
-layout(location = 1) in float scale;
-layout(location = 2) in float ch;
-layout(location = 3) in vec4 color;
+layout(location = 0) in ivec2 cell;
+layout(location = 1) in uint ch;
+layout(location = 2) in uint color;
 
 out vec2 uv;
-out float glyph_ch;
+flat out float glyph_solid;
 out vec4 glyph_color;
 
+// Glyph positions are in pixels with the origin at the top left corner
+// of the window, the same as the SDL renderer
 vec2 project_point(vec2 point) 
 {
-    return 2.0 * point/resolution;
+    return vec2(2.0*point.x/resolution.x - 1.0, 1.0 - 2.0*point.y/resolution.y);
 }
 
 void main() 
 {
-    uv = vec2(float(gl_VertexID & 1), float((gl_VertexID >> 1) & 1));
-    vec2 char_size = vec2(float(FONT_CHAR_WIDTH), float(FONT_CHAR_HEIGHT));
-    gl_Position = vec4(project_point(uv * char_size * scale + pos), 0.0, 1.0);
-    glyph_ch = ch;
-    glyph_color = color;
+    vec2 corner = vec2(float(gl_VertexID & 1), float((gl_VertexID >> 1) & 1));
+    vec2 pos = origin + vec2(cell)*cell_size;
+    gl_Position = vec4(project_point(corner*cell_size + pos), 0.0, 1.0);
+
+    // The atlas cell is looked up once per corner instead of once per
+    // fragment, the rasterizer interpolates the rest
+    int c = int(ch);
+    bool solid = c == GLYPH_SOLID;
+    if (!(ASCII_DISPLAY_LOW <= c && c <= ASCII_DISPLAY_HIGH)) {
+        c = 63;
+    }
+    int idx = c - ASCII_DISPLAY_LOW;
+    vec2 atlas_pos = vec2(float(idx % FONT_COLS)*FONT_CHAR_WIDTH_UV,
+                          float(idx / FONT_COLS)*FONT_CHAR_HEIGHT_UV);
+    uv = atlas_pos + corner*vec2(FONT_CHAR_WIDTH_UV, FONT_CHAR_HEIGHT_UV);
+
+    glyph_solid = solid ? 1.0 : 0.0;
+    glyph_color = solid ? palette[color] : palette[color]*tint;
 }
@@ -6,33 +6,67 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "sv.h"
+#include "journal.h"
+#include "line_index.h"
+#include "piece_table.h"
+#include "rope.h"
+#include "save.h"
+#include "spans.h"
+#include "undo.h"
+
+// Lines up to this many bytes are kept in the Line itself
+#define LINE_INLINE_CAPACITY 24
+// The smallest buffer a line allocates once it does not fit inline
+#define LINE_MIN_HEAP_CAPACITY 32
+// Sizes are 32 bit to keep a Line at 40 bytes. Longer lines of a loaded
+// file are split into rows that are joined back together on save.
+#ifndef LINE_MAX_SIZE
+#define LINE_MAX_SIZE ((size_t) UINT32_MAX)
+#endif
 
-#define LINE_INIT_CAPACITY 1024
+typedef enum {
+    // The text is in `inline_es`. A zeroed Line is an empty inline line.
+    LINE_INLINE = 0,
+    // `es` was malloc'd by the line itself
+    LINE_OWNED,
+    // `es` points into memory owned by somebody else (a memory mapped file
+    // or the line arena) and is copied into a buffer of the line's own on
+    // the first edit
+    LINE_BORROWED,
+} Line_Storage;
 
+// Every line is a gap buffer: the text is es[0..gap) followed by
+// es[gap+(capacity-size)..capacity), where es is `inline_es` for inline
+// lines. The gap is only moved to the column being edited, so typing next
+// to the previous edit does not shift the tail.
 typedef struct {
-    size_t capacity;
-    size_t size;
-    char *es;
+    // A Line_Storage, in a byte so that the flag below fits next to it
+    uint8_t storage;
+    // The row goes on where the one before it ends, without a newline in
+    // between. Only set on the pieces of a line longer than LINE_MAX_SIZE.
+    bool continued;
+    uint32_t capacity;
+    uint32_t size;
+    uint32_t gap;
+    union {
+        char *es;
+        char inline_es[LINE_INLINE_CAPACITY];
+    };
 } Line;
 
-static void line_extend(Line *line, size_t n)
-{
-    size_t new_capacity = line->capacity;
-    assert(new_capacity >= line->size);
-    while (new_capacity - line->size < n) {
-        if (line->capacity == 0) {
-            new_capacity = LINE_INIT_CAPACITY;
-        } else {
-            new_capacity = new_capacity*2;
-        }
-    }
-    if (new_capacity != line->capacity) {
-        line->es = realloc(line->es, new_capacity);
-        line->capacity = new_capacity;
-    }
-}
+String_View line_left(const Line *line);
+String_View line_right(const Line *line);
+const char *line_char_at(const Line *line, size_t col);
 
 void line_append_text(Line *line, const char *text);
 void line_append_text_sized(Line *line, const char *text, size_t text_size);
@@ -41,30 +75,333 @@ void line_insert_text_sized_before(Line *line, const char *text, size_t text_siz
 void line_backspace(Line *line, size_t *col);
 void line_delete(Line *line, size_t *col);
 
+// Blocks of text that borrowed lines point into: files that could not be
+// mapped and the copy of the mapping made by editor_unmap(). A block holds
+// many lines and is only freed together with the editor, so loading a file
+// costs about its size instead of an allocation per line.
+typedef struct {
+    char **blocks;
+    size_t count;
+    size_t capacity;
+    // The block line_arena_copy() is filling
+    char *tail;
+    size_t tail_size;
+} Line_Arena;
+
+#define LINE_ARENA_INIT_CAPACITY 16
+#define LINE_ARENA_BLOCK_SIZE (1024*1024)
+
 #define EDITOR_INIT_CAPACITY 128
+// Upper bound on lines published by a single editor_load_poll() so that a
+// finished index slice does not stall a frame
+#define EDITOR_PUBLISH_BATCH (1024*1024)
+// Input that is read instead of mapped is read this much at a time, so
+// the progress of a big file moves along
+#define EDITOR_READ_CHUNK_SIZE (16*1024*1024)
+// With `save_in_place`, saving the loaded file only patches the changed
+// bytes in place if it is at least this big and no more than this much of
+// it changed. Anything else gets the full, atomic save.
+#define EDITOR_PATCH_MIN_FILE_SIZE (1024*1024)
+#define EDITOR_PATCH_MAX_SIZE (64*1024*1024)
+// An edit that changes the size of a line moves the rest of the file.
+// Rewriting more than this much of it in place is not worth the risk, and
+// neither are more writes than EDITOR_PATCH_MAX_RANGES.
+#define EDITOR_PATCH_MAX_SHIFT (1024*1024)
+#define EDITOR_PATCH_MAX_RANGES 1024
+// Unchanged bytes between two changes are written along with them if there
+// are fewer than this, since the page they are on gets written anyway
+#define EDITOR_PATCH_GAP_SIZE 4096
+
+typedef enum {
+    EDITOR_BACKEND_LINES = 0,
+    EDITOR_BACKEND_PIECE_TABLE,
+    EDITOR_BACKEND_ROPE,
+} Editor_Backend;
+
+// Input that can not be mapped (pipes, and any file for the piece table
+// and the rope) is read on a thread of its own, which also builds the
+// piece table or the rope out of it. The editor takes the result over
+// once it is done, so a big file does not keep the window from showing.
+typedef struct {
+    Editor_Backend backend;
+    int fd;
+    pthread_t thread;
+    bool running;
+    // The size of the file if it was known upfront, 0 otherwise
+    size_t expected;
+    atomic_size_t read;
+    atomic_bool done;
+    atomic_bool stop;
+    // EDITOR_BACKEND_LINES, to be indexed by the editor
+    char *data;
+    size_t size;
+    Piece_Table pt;
+    Rope rope;
+} Editor_Loader;
 
 typedef struct {
+    Editor_Backend backend;
+    // EDITOR_BACKEND_LINES
     size_t capacity;
     size_t size;
     Line *lines;
+    // Some line is longer than LINE_MAX_SIZE, or was, and went on in rows
+    // that continue it
+    bool split_lines;
+    Line_Arena arena;
+    // The loaded file mapped into memory. Lines start out borrowed from it.
+    char *mapping;
+    size_t mapping_size;
+    dev_t mapping_dev;
+    ino_t mapping_ino;
+    // The mapped file as it is on disk since it was loaded or last
+    // patched. A zero mtime means it can not be patched anymore.
+    struct timespec mapping_mtime;
+    size_t mapping_file_size;
+    // Lines before this one were not edited since the file was last
+    // written, so they are on disk exactly where they are in the editor
+    size_t first_dirty_row;
+    // Newlines of the mapping (or of the arena block the file was read
+    // into), indexed in the background. Lines are appended to the editor
+    // as soon as their end is known.
+    Line_Index index;
+    size_t index_published;
+    Editor_Loader loader;
+    // EDITOR_BACKEND_PIECE_TABLE
+    Piece_Table pt;
+    // EDITOR_BACKEND_ROPE
+    Rope rope;
+    Save_Fsync save_fsync;
+    // Lets a small edit to a big mapped file be written back in place. That
+    // is not atomic, a crash in the middle of it leaves a mix of the old and
+    // the new file behind, so it has to be asked for.
+    bool save_in_place;
+    // The snapshot being written in the background by editor_save_start()
+    Save_Writer save;
+    // Another save that was requested while that one was still running
+    char *save_pending_path;
+    // What editor_undo() and editor_redo() go through
+    Undo_Journal undo;
+    // Edits not saved yet, on disk for crash recovery. Only kept once
+    // editor_journal_open() was called.
+    Journal journal;
+    // Edits of an earlier session that editor_journal_poll() replays once
+    // the file is loaded. They are in the journal already.
+    Journal_Reader replay;
+    bool replaying;
+    // The running save is of the journaled file, as of `save_checkpoint`
+    bool save_journaled;
+    size_t save_checkpoint;
     size_t cursor_row;
     size_t cursor_col;
 } Editor;
 
-static void editor_create_first_line(Editor *editor);
+typedef enum {
+    EDITOR_SAVE_IDLE = 0,
+    EDITOR_SAVE_RUNNING,
+    // Reported once by editor_save_poll() for every finished save
+    EDITOR_SAVE_DONE,
+    EDITOR_SAVE_FAILED,
+} Editor_Save_Status;
+
+typedef void (*Editor_Chunk_Visitor)(String_View chunk, void *data);
+
+size_t editor_line_count(const Editor *editor);
+void editor_visit_line(const Editor *editor, size_t row, Editor_Chunk_Visitor visit, void *data);
+void editor_visit_line_cols(const Editor *editor, size_t row, size_t col, size_t count,
+                            Editor_Chunk_Visitor visit, void *data);
 
 void editor_insert_new_line(Editor *editor);
 void editor_insert_text_before_cursor(Editor *editor, const char *text);
 void editor_backspace(Editor *editor);
 void editor_delete(Editor *editor);
+bool editor_undo(Editor *editor);
+bool editor_redo(Editor *editor);
 
-void editor_save_to_file(const Editor *editor, const char *filepath);
+bool editor_save_to_file(Editor *editor, const char *filepath);
+void editor_save_start(Editor *editor, const char *filepath);
+Editor_Save_Status editor_save_poll(Editor *editor, int *error);
+Editor_Save_Status editor_save_wait(Editor *editor, int *error);
 void editor_load_from_file(Editor *editor, FILE *fd);
+void editor_journal_open(Editor *editor, const char *file_path);
+size_t editor_journal_poll(Editor *editor);
+size_t editor_journal_wait(Editor *editor);
+void editor_journal_close(Editor *editor);
+void editor_unmap(Editor *editor);
+void editor_free(Editor *editor);
+bool editor_load_poll(Editor *editor);
+void editor_load_wait(Editor *editor);
+float editor_load_progress(const Editor *editor);
+bool editor_loading(const Editor *editor);
+bool editor_editable(const Editor *editor);
 
 const char *editor_char_under_cursor(Editor *editor);
 
 #ifdef EDITOR_IMPLEMENTATION
 
+static char *line_data(const Line *line)
+{
+    return line->storage == LINE_INLINE ? (char*) line->inline_es : line->es;
+}
+
+static size_t line_gap_end(const Line *line)
+{
+    return line->gap + (line->capacity - line->size);
+}
+
+static Line line_borrow(const char *data, size_t size)
+{
+    assert(size <= LINE_MAX_SIZE);
+    return (Line) {
+        .storage = LINE_BORROWED,
+        .capacity = size,
+        .size = size,
+        .gap = size,
+        .es = (char*) data,
+    };
+}
+
+// Heap capacities go 32, 48, 64, 96, 128, 192, ... so a line never
+// wastes more than a third of its buffer and still grows geometrically
+static size_t line_size_class(size_t size)
+{
+    if (size <= LINE_INLINE_CAPACITY) {
+        return LINE_INLINE_CAPACITY;
+    }
+    size_t capacity = LINE_MIN_HEAP_CAPACITY;
+    while (capacity < size) {
+        if ((capacity & (capacity - 1)) == 0) {
+            capacity += capacity/2;
+        } else {
+            capacity = capacity/3*4;
+        }
+    }
+    return capacity < LINE_MAX_SIZE ? capacity : LINE_MAX_SIZE;
+}
+
+// Moves the text into a buffer of `capacity` bytes, or into the Line
+// itself if it fits, keeping the gap where it is
+static void line_resize(Line *line, size_t capacity)
+{
+    assert(capacity >= line->size);
+    assert(capacity <= LINE_MAX_SIZE);
+    const size_t tail_size = line->size - line->gap;
+    const size_t tail = line_gap_end(line);
+    char *const es = line_data(line);
+
+    if (capacity <= LINE_INLINE_CAPACITY) {
+        // `inline_es` overlaps `es`, so the text goes through a copy
+        char text[LINE_INLINE_CAPACITY];
+        memcpy(text, es, line->gap);
+        memcpy(text+LINE_INLINE_CAPACITY-tail_size, es+tail, tail_size);
+        if (line->storage == LINE_OWNED) {
+            free(es);
+        }
+        memcpy(line->inline_es, text, LINE_INLINE_CAPACITY);
+        line->storage = LINE_INLINE;
+        line->capacity = LINE_INLINE_CAPACITY;
+        return;
+    }
+
+    if (line->storage == LINE_OWNED) {
+        if (capacity > line->capacity) {
+            line->es = realloc(line->es, capacity);
+            memmove(line->es+capacity-tail_size, line->es+tail, tail_size);
+        } else {
+            memmove(line->es+capacity-tail_size, line->es+tail, tail_size);
+            line->es = realloc(line->es, capacity);
+        }
+    } else {
+        char *owned = malloc(capacity);
+        memcpy(owned, es, line->gap);
+        memcpy(owned+capacity-tail_size, es+tail, tail_size);
+        line->storage = LINE_OWNED;
+        line->es = owned;
+    }
+    line->capacity = capacity;
+}
+
+// Makes room for `n` more bytes. Borrowed lines are always copied, since
+// their text can not be modified.
+static void line_extend(Line *line, size_t n)
+{
+    assert(line->size + n <= LINE_MAX_SIZE && "line is too long");
+    if (line->storage == LINE_BORROWED || line->capacity - line->size < n) {
+        line_resize(line, line_size_class(line->size + n));
+    }
+}
+
+// Gives memory back once a line is down to a quarter of its buffer. It is
+// shrunk to the class of twice its size, so that typing right after the
+// deletion does not have to grow it again.
+static void line_shrink(Line *line)
+{
+    if (line->storage == LINE_OWNED && line->size <= line->capacity/4) {
+        line_resize(line, line_size_class(line->size*2));
+    }
+}
+
+static void line_move_gap(Line *line, size_t col)
+{
+    assert(col <= line->size);
+    char *const es = line_data(line);
+    const size_t gap_size = line->capacity - line->size;
+    if (col < line->gap) {
+        memmove(es+col+gap_size, es+col, line->gap-col);
+    } else if (col > line->gap) {
+        memmove(es+line->gap, es+line->gap+gap_size, col-line->gap);
+    }
+    line->gap = col;
+}
+
+// Takes ownership of a malloc'd block
+static void line_arena_push(Line_Arena *arena, char *block)
+{
+    if (arena->count >= arena->capacity) {
+        size_t new_capacity = arena->capacity;
+        if (new_capacity == 0) {
+            new_capacity = LINE_ARENA_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+        arena->blocks = realloc(arena->blocks, new_capacity*sizeof(arena->blocks[0]));
+        arena->capacity = new_capacity;
+    }
+    arena->blocks[arena->count++] = block;
+}
+
+// Copies text into the arena, small pieces one after the other into
+// blocks of LINE_ARENA_BLOCK_SIZE
+static char *line_arena_copy(Line_Arena *arena, const char *data, size_t size)
+{
+    if (size > LINE_ARENA_BLOCK_SIZE/4) {
+        char *block = malloc(size);
+        memcpy(block, data, size);
+        line_arena_push(arena, block);
+        return block;
+    }
+    if (arena->tail == NULL || LINE_ARENA_BLOCK_SIZE - arena->tail_size < size) {
+        arena->tail = malloc(LINE_ARENA_BLOCK_SIZE);
+        arena->tail_size = 0;
+        line_arena_push(arena, arena->tail);
+    }
+    char *copy = arena->tail + arena->tail_size;
+    memcpy(copy, data, size);
+    arena->tail_size += size;
+    return copy;
+}
+
+static void line_arena_free(Line_Arena *arena)
+{
+    for (size_t i = 0; i < arena->count; ++i) {
+        free(arena->blocks[i]);
+    }
+    free(arena->blocks);
+    memset(arena, 0, sizeof(*arena));
+}
+
+static void editor_create_first_line(Editor *editor);
+
 void line_append_text_sized(Line *line, const char *text, size_t text_size)
 {
     size_t col = line->size;
@@ -82,12 +419,9 @@ void line_insert_text_sized_before(Line *line, const char *text, size_t text_siz
         (*col) = line->size;
     }
     line_extend(line, text_size);
-    memmove(
-        line->es+(*col)+text_size,
-        line->es+(*col),
-        line->size-(*col)
-    );
-    memcpy(line->es+(*col), text, text_size);
+    line_move_gap(line, *col);
+    memcpy(line_data(line)+line->gap, text, text_size);
+    line->gap += text_size;
     line->size += text_size;
     *col += text_size;
 }
@@ -103,9 +437,12 @@ void line_backspace(Line *line, size_t *col)
         (*col) = line->size;
     }
     if (line->size > 0 && (*col) > 0) {
-        memcpy(line->es+(*col)-1, line->es+(*col), line->size-(*col));
+        line_extend(line, 0);
+        line_move_gap(line, *col);
+        line->gap-=1;
         line->size-=1;
         *col-=1;
+        line_shrink(line);
     }
 }
 
@@ -115,9 +452,47 @@ void line_delete(Line *line, size_t *col)
         (*col) = line->size;
     }
     if ((*col) < line->size && line->size > 0) {
-        memcpy(line->es+(*col), line->es+(*col)+1, line->size-(*col));
+        line_extend(line, 0);
+        line_move_gap(line, *col);
         line->size-=1;
+        line_shrink(line);
+    }
+}
+
+// Removes `count` bytes from col onwards. Right after they were typed the
+// gap is already behind them, so nothing has to move.
+static void line_erase(Line *line, size_t col, size_t count)
+{
+    assert(col + count <= line->size);
+    if (count == 0) {
+        return;
+    }
+    line_extend(line, 0);
+    line_move_gap(line, col + count);
+    line->gap -= count;
+    line->size -= count;
+    line_shrink(line);
+}
+
+String_View line_left(const Line *line)
+{
+    return sv_from_parts(line_data(line), line->gap);
+}
+
+String_View line_right(const Line *line)
+{
+    return sv_from_parts(line_data(line)+line_gap_end(line), line->size-line->gap);
+}
+
+const char *line_char_at(const Line *line, size_t col)
+{
+    if (col >= line->size) {
+        return NULL;
     }
+    if (col < line->gap) {
+        return &line_data(line)[col];
+    }
+    return &line_data(line)[line_gap_end(line)+(col-line->gap)];
 }
 
 // EDITOR //
@@ -127,7 +502,7 @@ void editor_grow(Editor *editor, size_t n)
     size_t new_capacity = editor->capacity;
     assert(new_capacity >= editor->size);
     while (new_capacity - editor->size < n) {
-        if (editor->capacity == 0) {
+        if (new_capacity == 0) {
             new_capacity = EDITOR_INIT_CAPACITY;
         } else {
             new_capacity = new_capacity*2;
@@ -139,106 +514,1578 @@ void editor_grow(Editor *editor, size_t n)
     }
 }
 
+// The piece table and the rope both address the document by byte offsets,
+// so the editor_* functions share the same code for them.
+
+static size_t editor_doc_size(const Editor *editor)
+{
+    return editor->backend == EDITOR_BACKEND_ROPE ? rope_size(&editor->rope) : editor->pt.size;
+}
+
+static size_t editor_doc_line_count(const Editor *editor)
+{
+    return editor->backend == EDITOR_BACKEND_ROPE ? rope_line_count(&editor->rope) : pt_line_count(&editor->pt);
+}
+
+static size_t editor_doc_line_offset(const Editor *editor, size_t row)
+{
+    return editor->backend == EDITOR_BACKEND_ROPE ? rope_line_offset(&editor->rope, row) : pt_line_offset(&editor->pt, row);
+}
+
+static size_t editor_doc_line_size(const Editor *editor, size_t row)
+{
+    return editor->backend == EDITOR_BACKEND_ROPE ? rope_line_size(&editor->rope, row) : pt_line_size(&editor->pt, row);
+}
+
+static const char *editor_doc_char_at(const Editor *editor, size_t offset)
+{
+    return editor->backend == EDITOR_BACKEND_ROPE ? rope_char_at(&editor->rope, offset) : pt_char_at(&editor->pt, offset);
+}
+
+static void editor_doc_insert(Editor *editor, size_t offset, const char *text, size_t text_size)
+{
+    if (editor->backend == EDITOR_BACKEND_ROPE) {
+        rope_insert(&editor->rope, offset, text, text_size);
+    } else {
+        pt_insert(&editor->pt, offset, text, text_size);
+    }
+}
+
+static void editor_doc_delete(Editor *editor, size_t offset, size_t count)
+{
+    if (editor->backend == EDITOR_BACKEND_ROPE) {
+        rope_delete(&editor->rope, offset, count);
+    } else {
+        pt_delete(&editor->pt, offset, count);
+    }
+}
+
+static void editor_doc_visit(const Editor *editor, size_t offset, size_t count, Editor_Chunk_Visitor visit, void *data)
+{
+    if (editor->backend == EDITOR_BACKEND_ROPE) {
+        rope_visit(&editor->rope, offset, count, visit, data);
+    } else {
+        pt_visit(&editor->pt, offset, count, visit, data);
+    }
+}
+
+// Offset of the cursor inside of the document. Clamps the cursor column
+// to the line the same way line_* functions do.
+static size_t editor_doc_cursor_offset(Editor *editor)
+{
+    const size_t line_size = editor_doc_line_size(editor, editor->cursor_row);
+    if (editor->cursor_col > line_size) {
+        editor->cursor_col = line_size;
+    }
+    return editor_doc_line_offset(editor, editor->cursor_row) + editor->cursor_col;
+}
+
+// Called before the line under the cursor is edited
+static void editor_mark_dirty(Editor *editor)
+{
+    if (editor->cursor_row < editor->first_dirty_row) {
+        editor->first_dirty_row = editor->cursor_row;
+    }
+}
+
 static void editor_create_first_line(Editor *editor)
 {
-    if (editor->cursor_row >= editor->size) {
-        if (editor->size > 0) {
-            editor->cursor_row = editor->size-1; 
-        } else {
-            editor_grow(editor, 1);
-            memset(&editor->lines[editor->size], 0, sizeof(editor->lines[0]));
-            editor->size+=1;
+    // Edits go on top of those of the earlier session
+    if (editor->replay.data != NULL) {
+        editor_journal_wait(editor);
+    }
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        if (editor->size == 0) {
+            // Anything typed into the document must come before the lines
+            // that are still being indexed. A caller that can not wait
+            // checks editor_editable() first.
+            editor_load_wait(editor);
         }
+        if (editor->cursor_row >= editor->size) {
+            if (editor->size > 0) {
+                editor->cursor_row = editor->size-1; 
+            } else {
+                editor_grow(editor, 1);
+                memset(&editor->lines[editor->size], 0, sizeof(editor->lines[0]));
+                editor->size+=1;
+            }
+        }
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        // The document is only there once it is completely loaded, see
+        // editor_editable()
+        editor_load_wait(editor);
+        // An offset addressed document always has at least one (possibly empty) line
+        const size_t line_count = editor_doc_line_count(editor);
+        if (editor->cursor_row >= line_count) {
+            editor->cursor_row = line_count-1;
+        }
+    } break;
+    default:
+        assert(0 && "unreachable");
     }
 }
 
-void editor_insert_new_line(Editor *editor)
+size_t editor_line_count(const Editor *editor)
+{
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES:
+        return editor->size;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE:
+        return editor_doc_line_count(editor);
+    default:
+        assert(0 && "unreachable");
+        return 0;
+    }
+}
+
+void editor_visit_line(const Editor *editor, size_t row, Editor_Chunk_Visitor visit, void *data)
+{
+    editor_visit_line_cols(editor, row, 0, SIZE_MAX, visit, data);
+}
+
+// Visits the part of `chunk` that falls into the column range, where
+// `*col` is the column the chunk starts at. Advances `*col` past the chunk.
+static void editor_visit_clipped(String_View chunk, size_t *col, size_t begin, size_t end,
+                                 Editor_Chunk_Visitor visit, void *data)
+{
+    const size_t chunk_begin = *col;
+    const size_t chunk_end = chunk_begin + chunk.count;
+    *col = chunk_end;
+    const size_t from = chunk_begin > begin ? chunk_begin : begin;
+    const size_t to = chunk_end < end ? chunk_end : end;
+    if (from < to) {
+        visit(sv_from_parts(chunk.data + (from - chunk_begin), to - from), data);
+    }
+}
+
+// Only visits the columns [col..col+count) of the line, so that the
+// renderer does not touch the text that is scrolled out of view.
+void editor_visit_line_cols(const Editor *editor, size_t row, size_t col, size_t count,
+                            Editor_Chunk_Visitor visit, void *data)
+{
+    const size_t end = count > SIZE_MAX - col ? SIZE_MAX : col + count;
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        if (row < editor->size) {
+            size_t chunk_col = 0;
+            editor_visit_clipped(line_left(&editor->lines[row]), &chunk_col, col, end, visit, data);
+            editor_visit_clipped(line_right(&editor->lines[row]), &chunk_col, col, end, visit, data);
+        }
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        if (row < editor_doc_line_count(editor)) {
+            const size_t size = editor_doc_line_size(editor, row);
+            if (col < size) {
+                editor_doc_visit(editor, editor_doc_line_offset(editor, row) + col,
+                                 (end < size ? end : size) - col, visit, data);
+            }
+        }
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+static void editor_journal_edit(Editor *editor, Journal_Kind kind, size_t row, size_t col,
+                                const char *text, size_t count)
 {
-    if (editor->cursor_row > editor->size) {
-        editor->cursor_row = editor->size;
+    if (editor->journal.path != NULL && !editor->replaying) {
+        journal_edit(&editor->journal, kind, row, col, text, count);
     }
+}
+
+// Inserts an empty line after `row`
+static void editor_apply_new_line(Editor *editor, size_t row)
+{
+    editor_journal_edit(editor, JOURNAL_NEW_LINE, row, 0, NULL, 0);
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        editor_grow(editor, 1);
+        const size_t line_size = sizeof(editor->lines[0]);
+        memmove(
+            editor->lines + row+1,
+            editor->lines + row,
+            (editor->size - row) * line_size
+        );
+        memset(&editor->lines[row+1], 0, line_size);
+        editor->size += 1;
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        const size_t offset = editor_doc_line_offset(editor, row) + editor_doc_line_size(editor, row);
+        editor_doc_insert(editor, offset, "\n", 1);
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+// Moves the text of `row` from `col` on into a new row right after it,
+// which continues it. Only for EDITOR_BACKEND_LINES.
+static void editor_split_row(Editor *editor, size_t row, size_t col)
+{
     editor_grow(editor, 1);
     const size_t line_size = sizeof(editor->lines[0]);
     memmove(
-        editor->lines + editor->cursor_row+1,
-        editor->lines + editor->cursor_row,
-        (editor->size - editor->cursor_row) * line_size
+        editor->lines + row+2,
+        editor->lines + row+1,
+        (editor->size - (row+1)) * line_size
     );
-    memset(&editor->lines[editor->cursor_row+1], 0, line_size);
+    memset(&editor->lines[row+1], 0, line_size);
+    editor->size += 1;
+    editor->split_lines = true;
+
+    Line *line = &editor->lines[row];
+    Line *next = &editor->lines[row+1];
+    next->continued = true;
+    const String_View left = line_left(line);
+    const String_View right = line_right(line);
+    if (col < left.count) {
+        line_append_text_sized(next, left.data + col, left.count - col);
+        line_append_text_sized(next, right.data, right.count);
+    } else {
+        line_append_text_sized(next, right.data + (col - left.count), right.count - (col - left.count));
+    }
+    line_erase(line, col, line->size - col);
+}
+
+// Inserts into a row of EDITOR_BACKEND_LINES. Text that does not fit in
+// the row any more goes on in new rows that continue it: the rest of the
+// row is split off first, and the text fills up the row and as many new
+// rows as it takes. Moves row:col to the end of the text and returns how
+// many rows were added, see editor_apply_unspill() for the way back.
+static size_t editor_lines_insert(Editor *editor, size_t *row, size_t *col, const char *text, size_t text_size)
+{
+    Line *line = &editor->lines[*row];
+    if (*col > line->size) {
+        *col = line->size;
+    }
+    size_t rows = 0;
+    if (line->size + text_size > LINE_MAX_SIZE && *col < line->size) {
+        editor_split_row(editor, *row, *col);
+        rows += 1;
+    }
+    while (text_size > 0) {
+        line = &editor->lines[*row];
+        size_t n = LINE_MAX_SIZE - line->size;
+        if (n > text_size) {
+            n = text_size;
+        }
+        if (n > 0) {
+            line_insert_text_sized_before(line, text, n, col);
+            text += n;
+            text_size -= n;
+        }
+        if (text_size > 0) {
+            editor_split_row(editor, *row, *col);
+            rows += 1;
+            *row += 1;
+            *col = 0;
+        }
+    }
+    return rows;
+}
+
+void editor_insert_new_line(Editor *editor)
+{
+    editor_create_first_line(editor);
+    if (editor->backend == EDITOR_BACKEND_LINES) {
+        editor_mark_dirty(editor);
+    }
+    editor_apply_new_line(editor, editor->cursor_row);
+    undo_record(&editor->undo, UNDO_NEW_LINE, editor->cursor_row, 0, NULL, 0, 0);
     editor->cursor_row += 1;
     editor->cursor_col = 0;
-    editor->size += 1;
 }
 
 void editor_insert_text_before_cursor(Editor *editor, const char *text)
 {
     editor_create_first_line(editor);
-    line_insert_text_before(&editor->lines[editor->cursor_row], text, &editor->cursor_col);
+    const size_t text_size = strlen(text);
+    // Where the text starts, it may not end on the same row
+    const size_t row = editor->cursor_row;
+    size_t col = 0;
+    size_t rows = 0;
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        editor_mark_dirty(editor);
+        const size_t size = editor->lines[row].size;
+        if (editor->cursor_col > size) {
+            editor->cursor_col = size;
+        }
+        col = editor->cursor_col;
+        rows = editor_lines_insert(editor, &editor->cursor_row, &editor->cursor_col, text, text_size);
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        editor_doc_insert(editor, editor_doc_cursor_offset(editor), text, text_size);
+        col = editor->cursor_col;
+        editor->cursor_col += text_size;
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+    if (text_size > 0) {
+        undo_record(&editor->undo, UNDO_INSERT, row, col, text, text_size, rows);
+        editor_journal_edit(editor, JOURNAL_INSERT, row, col, text, text_size);
+    }
 }
 
 void editor_backspace(Editor *editor)
 {
     editor_create_first_line(editor);
-    line_backspace(&editor->lines[editor->cursor_row], &editor->cursor_col);
+    // The byte that goes away, for the journal
+    char erased = 0;
+    bool erasing = false;
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        Line *line = &editor->lines[editor->cursor_row];
+        editor_mark_dirty(editor);
+        if (editor->cursor_col > line->size) {
+            editor->cursor_col = line->size;
+        }
+        erasing = editor->cursor_col > 0;
+        if (erasing) {
+            erased = *line_char_at(line, editor->cursor_col - 1);
+        }
+        line_backspace(line, &editor->cursor_col);
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        const size_t offset = editor_doc_cursor_offset(editor);
+        erasing = editor->cursor_col > 0;
+        if (erasing) {
+            erased = *editor_doc_char_at(editor, offset-1);
+            editor_doc_delete(editor, offset-1, 1);
+            editor->cursor_col -= 1;
+        }
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+    if (erasing) {
+        undo_record(&editor->undo, UNDO_BACKSPACE, editor->cursor_row, editor->cursor_col, &erased, 1, 0);
+        editor_journal_edit(editor, JOURNAL_ERASE, editor->cursor_row, editor->cursor_col, NULL, 1);
+    }
 }
 
 void editor_delete(Editor *editor)
 {
     editor_create_first_line(editor);
-    line_delete(&editor->lines[editor->cursor_row], &editor->cursor_col);
+    char erased = 0;
+    bool erasing = false;
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        Line *line = &editor->lines[editor->cursor_row];
+        editor_mark_dirty(editor);
+        if (editor->cursor_col > line->size) {
+            editor->cursor_col = line->size;
+        }
+        erasing = editor->cursor_col < line->size;
+        if (erasing) {
+            erased = *line_char_at(line, editor->cursor_col);
+        }
+        line_delete(line, &editor->cursor_col);
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        const size_t offset = editor_doc_cursor_offset(editor);
+        erasing = editor->cursor_col < editor_doc_line_size(editor, editor->cursor_row);
+        if (erasing) {
+            erased = *editor_doc_char_at(editor, offset);
+            editor_doc_delete(editor, offset, 1);
+        }
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+    if (erasing) {
+        undo_record(&editor->undo, UNDO_DELETE, editor->cursor_row, editor->cursor_col, &erased, 1, 0);
+        editor_journal_edit(editor, JOURNAL_ERASE, editor->cursor_row, editor->cursor_col, NULL, 1);
+    }
+}
+
+// UNDO //
+
+// The edits below go around the undo journal. They get the document back to
+// the state a record was made in, so the row and the column always exist.
+
+// Moves row:col to the end of the inserted text
+static void editor_apply_insert(Editor *editor, size_t *row, size_t *col, const char *text, size_t text_size)
+{
+    editor_journal_edit(editor, JOURNAL_INSERT, *row, *col, text, text_size);
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        editor_lines_insert(editor, row, col, text, text_size);
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        editor_doc_insert(editor, editor_doc_line_offset(editor, *row) + *col, text, text_size);
+        *col += text_size;
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+static void editor_apply_erase(Editor *editor, size_t row, size_t col, size_t count)
+{
+    editor_journal_edit(editor, JOURNAL_ERASE, row, col, NULL, count);
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        line_erase(&editor->lines[row], col, count);
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        editor_doc_delete(editor, editor_doc_line_offset(editor, row) + col, count);
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+// Removes the empty line after `row`
+static void editor_apply_remove_line(Editor *editor, size_t row)
+{
+    editor_journal_edit(editor, JOURNAL_REMOVE_LINE, row, 0, NULL, 0);
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        Line *line = &editor->lines[row+1];
+        assert(line->size == 0);
+        if (line->storage == LINE_OWNED) {
+            free(line->es);
+        }
+        memmove(line, line + 1, (editor->size - (row+2))*sizeof(editor->lines[0]));
+        editor->size -= 1;
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        editor_doc_delete(editor, editor_doc_line_offset(editor, row) + editor_doc_line_size(editor, row), 1);
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+// Appends the row after `row`, which continues it, to it. Only for
+// EDITOR_BACKEND_LINES.
+static void editor_apply_join_line(Editor *editor, size_t row)
+{
+    editor_journal_edit(editor, JOURNAL_JOIN_LINE, row, 0, NULL, 0);
+    assert(editor->backend == EDITOR_BACKEND_LINES);
+    Line *line = &editor->lines[row];
+    Line *next = &editor->lines[row+1];
+    assert(next->continued);
+    const String_View left = line_left(next);
+    const String_View right = line_right(next);
+    line_append_text_sized(line, left.data, left.count);
+    line_append_text_sized(line, right.data, right.count);
+    if (next->storage == LINE_OWNED) {
+        free(next->es);
+    }
+    memmove(next, next + 1, (editor->size - (row+2))*sizeof(editor->lines[0]));
+    editor->size -= 1;
+}
+
+// Reverts an insert of `text_size` bytes at row:col that added `rows` rows,
+// see editor_lines_insert(). The text filled up the row and the rows right
+// after it, which are removed again, and the rest of the row follows in a
+// row of its own unless the text went to its end.
+static void editor_apply_unspill(Editor *editor, size_t row, size_t col, size_t text_size, size_t rows)
+{
+    const size_t text_rows = (col + text_size + LINE_MAX_SIZE - 1)/LINE_MAX_SIZE;
+    assert(rows + 1 >= text_rows && rows <= text_rows);
+    for (size_t i = 1; i < text_rows; ++i) {
+        editor_apply_erase(editor, row+1, 0, editor->lines[row+1].size);
+        editor_apply_remove_line(editor, row);
+    }
+    editor_apply_erase(editor, row, col, editor->lines[row].size - col);
+    if (rows == text_rows) {
+        editor_apply_join_line(editor, row);
+    }
+}
+
+static size_t editor_row_size(const Editor *editor, size_t row)
+{
+    return editor->backend == EDITOR_BACKEND_LINES ? editor->lines[row].size : editor_doc_line_size(editor, row);
+}
+
+// Reverts the last edit that was not undone yet and puts the cursor where
+// it happened. Undoing costs as much as the edit did, no matter how big
+// the document is. Returns false if there is nothing to undo.
+bool editor_undo(Editor *editor)
+{
+    const Undo_Record *record = undo_pop(&editor->undo);
+    if (record == NULL) {
+        return false;
+    }
+    const char *text = undo_text(&editor->undo, record);
+    editor->cursor_row = record->row;
+    editor->cursor_col = record->col;
+    if (editor->backend == EDITOR_BACKEND_LINES) {
+        editor_mark_dirty(editor);
+    }
+    switch (record->kind) {
+    case UNDO_INSERT: {
+        if (record->rows > 0) {
+            editor_apply_unspill(editor, record->row, record->col, record->text_size, record->rows);
+        } else {
+            editor_apply_erase(editor, record->row, record->col, record->text_size);
+        }
+    } break;
+    case UNDO_DELETE: {
+        size_t row = record->row;
+        size_t col = record->col;
+        editor_apply_insert(editor, &row, &col, text, record->text_size);
+    } break;
+    case UNDO_BACKSPACE: {
+        char *reversed = malloc(record->text_size);
+        for (size_t i = 0; i < record->text_size; ++i) {
+            reversed[i] = text[record->text_size - 1 - i];
+        }
+        editor_apply_insert(editor, &editor->cursor_row, &editor->cursor_col, reversed, record->text_size);
+        free(reversed);
+    } break;
+    case UNDO_NEW_LINE: {
+        editor_apply_remove_line(editor, record->row);
+        editor->cursor_col = editor_row_size(editor, record->row);
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+    return true;
+}
+
+// Makes the last undone edit again. Returns false if there is none.
+bool editor_redo(Editor *editor)
+{
+    const Undo_Record *record = undo_unpop(&editor->undo);
+    if (record == NULL) {
+        return false;
+    }
+    const char *text = undo_text(&editor->undo, record);
+    editor->cursor_row = record->row;
+    editor->cursor_col = record->col;
+    if (editor->backend == EDITOR_BACKEND_LINES) {
+        editor_mark_dirty(editor);
+    }
+    switch (record->kind) {
+    case UNDO_INSERT: {
+        editor_apply_insert(editor, &editor->cursor_row, &editor->cursor_col, text, record->text_size);
+    } break;
+    case UNDO_DELETE:
+    case UNDO_BACKSPACE: {
+        editor_apply_erase(editor, record->row, record->col, record->text_size);
+    } break;
+    case UNDO_NEW_LINE: {
+        editor_apply_new_line(editor, record->row);
+        editor->cursor_row += 1;
+        editor->cursor_col = 0;
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+    return true;
 }
 
 const char *editor_char_under_cursor(Editor *editor)
 {
-    if (editor->cursor_row < editor->size) {
-        if (editor->cursor_col < editor->lines[editor->cursor_row].size) {
-            return &editor->lines[editor->cursor_row].es[editor->cursor_col];
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        if (editor->cursor_row < editor->size) {
+            return line_char_at(&editor->lines[editor->cursor_row], editor->cursor_col);
         }
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        if (editor->cursor_row < editor_doc_line_count(editor)
+                && editor->cursor_col < editor_doc_line_size(editor, editor->cursor_row)) {
+            return editor_doc_char_at(editor, editor_doc_line_offset(editor, editor->cursor_row) + editor->cursor_col);
+        }
+    } break;
+    default:
+        assert(0 && "unreachable");
     }
     return NULL;
 }
 
-void editor_save_to_file(const Editor *editor, const char *filepath)
+// SAVING //
+
+// The size of the newline that goes before `row` in the file. The end of
+// the document counts as a row of its own.
+static size_t editor_newline_before(const Editor *editor, size_t row)
 {
-    FILE *fd = fopen(filepath, "w");
-    if (fd == NULL) {
-        fprintf(stderr, "ERROR: unable to open %s: %s\n", filepath, strerror(errno));
-        exit(1);
+    if (row == 0) {
+        return 0;
     }
-    for (size_t row=0;row<editor->size;++row) {
-        fwrite(editor->lines[row].es, 1, editor->lines[row].size, fd);
-        fputc('\n', fd);
+    return row < editor->size && editor->lines[row].continued ? 0 : 1;
+}
+
+// Edited lines are copied and borrowed lines are referenced where they
+// are, in the mapping or in the arena, which outlive the snapshot since
+// editor_unmap() and editor_free() wait for the save. Lines that follow
+// each other in the loaded file still do in memory, with the newline in
+// between, so an unedited stretch of the file becomes a single segment.
+
+static void editor_snapshot_lines(const Editor *editor, Save_Snapshot *snapshot)
+{
+    for (size_t row = 0; row < editor->size; ++row) {
+        const Line *line = &editor->lines[row];
+        if (editor_newline_before(editor, row) > 0) {
+            save_snapshot_copy(snapshot, "\n", 1);
+        }
+        if (line->storage == LINE_BORROWED) {
+            const char *const begin = line->es;
+            const char *end = line->es + line->size;
+            while (row + 1 < editor->size
+                    && editor->lines[row+1].storage == LINE_BORROWED
+                    && editor->lines[row+1].es == end + editor_newline_before(editor, row + 1)) {
+                row += 1;
+                end = editor->lines[row].es + editor->lines[row].size;
+            }
+            save_snapshot_push(snapshot, begin, end - begin);
+        } else {
+            const String_View left = line_left(line);
+            const String_View right = line_right(line);
+            save_snapshot_copy(snapshot, left.data, left.count);
+            save_snapshot_copy(snapshot, right.data, right.count);
+        }
     }
-    fclose(fd);
 }
 
-void editor_load_from_file(Editor *editor, FILE *file)
+// The original buffer is never modified, but appending to the add buffer
+// may move it, so only the text of the added pieces is copied
+static void editor_snapshot_pt(const Piece_Table *pt, Save_Snapshot *snapshot)
 {
-    assert(editor->lines == NULL && "you can only load files into an empty editor");
-    editor_create_first_line(editor);
-    static char chunk[1024*640];
-    while (feof(file) == 0) {
-        size_t n = fread(chunk, 1, sizeof(chunk), file);
-        String_View sv_chunk = {
-            .data = chunk,
-            .count = n
-        };
-        while (sv_chunk.count > 0) {
-            String_View chunk_line = {0}; 
-            Line *line = &editor->lines[editor->size-1];
-            if (sv_try_chop_by_delim(&sv_chunk, '\n', &chunk_line)) {
-                line_append_text_sized(line, chunk_line.data, chunk_line.count);
-                editor_insert_new_line(editor);
+    for (size_t i = 0; i < pt->pieces_count; ++i) {
+        const Piece *piece = &pt->pieces[i];
+        const char *data = pt->buffers[piece->source].data + piece->start;
+        if (piece->source == PIECE_ADD) {
+            save_snapshot_copy(snapshot, data, piece->size);
+        } else {
+            save_snapshot_push(snapshot, data, piece->size);
+        }
+    }
+}
+
+static void editor_snapshot_copy_chunk(String_View chunk, void *data)
+{
+    save_snapshot_copy(data, chunk.data, chunk.count);
+}
+
+static bool editor_line_in_mapping(const Editor *editor, const Line *line)
+{
+    return line->storage == LINE_BORROWED
+           && line->es >= editor->mapping && line->es <= editor->mapping + editor->mapping_size;
+}
+
+// Whether saving to `filepath` can patch the mapped file in place: it is
+// the same file and nobody else wrote to it since the editor did
+static bool editor_can_patch(const Editor *editor, const char *filepath)
+{
+    if (!editor->save_in_place || editor->backend != EDITOR_BACKEND_LINES || editor->mapping == NULL
+            || editor->mapping_mtime.tv_sec == 0
+            || editor->mapping_file_size < EDITOR_PATCH_MIN_FILE_SIZE) {
+        return false;
+    }
+    struct stat st;
+    return stat(filepath, &st) == 0 && S_ISREG(st.st_mode)
+           && st.st_dev == editor->mapping_dev && st.st_ino == editor->mapping_ino
+           && (size_t) st.st_size == editor->mapping_file_size
+           && st.st_mtim.tv_sec == editor->mapping_mtime.tv_sec
+           && st.st_mtim.tv_nsec == editor->mapping_mtime.tv_nsec;
+}
+
+// Starts the range of a patch that goes to `offset`. A small gap since the
+// last range is filled in from the mapping, which still has the bytes that
+// are in the file there.
+static void editor_patch_seek(const Editor *editor, Save_Snapshot *snapshot, size_t offset, size_t *dirty)
+{
+    if (snapshot->ranges_count > 0) {
+        const Save_Range *last = &snapshot->ranges[snapshot->ranges_count - 1];
+        const size_t end = last->offset + last->size;
+        if (offset > end && offset - end < EDITOR_PATCH_GAP_SIZE) {
+            save_snapshot_push(snapshot, editor->mapping + end, offset - end);
+            *dirty += offset - end;
+        }
+    }
+    save_snapshot_seek(snapshot, offset);
+}
+
+// Takes only the bytes that differ from the mapped file. The mapping
+// shows what is on disk, so a line borrowed from it at its own offset
+// is unchanged, and so is a newline that is already there unless a line
+// next to it changed. Every other line borrowed from the mapping is moved
+// into the arena first, since the patch may overwrite its text. Returns
+// false if too much changed, see EDITOR_PATCH_MAX_SIZE.
+static bool editor_snapshot_patch(Editor *editor, Save_Snapshot *snapshot)
+{
+    SPAN("editor_snapshot_patch");
+    snapshot->patch = true;
+    size_t mapped = editor->mapping_size;
+    if (mapped > editor->mapping_file_size) {
+        mapped = editor->mapping_file_size;
+    }
+
+    // The offset of the first dirty row is found from the closest line
+    // before it that is still in the mapping
+    size_t row = editor->first_dirty_row < editor->size ? editor->first_dirty_row : editor->size;
+    size_t offset = 0;
+    for (size_t prev = row; prev-- > 0;) {
+        const Line *line = &editor->lines[prev];
+        offset += line->size + editor_newline_before(editor, prev + 1);
+        if (editor_line_in_mapping(editor, line)) {
+            offset += line->es - editor->mapping;
+            break;
+        }
+    }
+    // The newline before `row` is checked together with the row
+    offset -= editor_newline_before(editor, row);
+
+    size_t dirty = 0;
+    bool prev_dirty = false;
+    for (; row < editor->size; ++row) {
+        Line *line = &editor->lines[row];
+        const size_t newline = editor_newline_before(editor, row);
+        const size_t at = offset + newline;
+        const bool in_mapping = editor_line_in_mapping(editor, line);
+        const bool shifted = in_mapping && (size_t) (line->es - editor->mapping) != at;
+        if (shifted && at < mapped && mapped - at > EDITOR_PATCH_MAX_SHIFT) {
+            return false;
+        }
+        const bool line_dirty = !in_mapping || shifted || at + line->size > mapped;
+        if (newline > 0) {
+            // Keeps the range going from one changed line to the next
+            if (prev_dirty || line_dirty || offset >= mapped || editor->mapping[offset] != '\n') {
+                editor_patch_seek(editor, snapshot, offset, &dirty);
+                save_snapshot_copy(snapshot, "\n", 1);
+                dirty += 1;
+            }
+            offset += 1;
+        }
+        if (line_dirty) {
+            dirty += line->size;
+            if (dirty > EDITOR_PATCH_MAX_SIZE) {
+                return false;
+            }
+            editor_patch_seek(editor, snapshot, offset, &dirty);
+            if (in_mapping) {
+                line->es = line_arena_copy(&editor->arena, line->es, line->size);
+            }
+            if (line->storage == LINE_BORROWED) {
+                save_snapshot_push(snapshot, line->es, line->size);
             } else {
-                line_append_text_sized(line, sv_chunk.data, sv_chunk.count);
-                sv_chunk = SV_NULL;
+                const String_View left = line_left(line);
+                const String_View right = line_right(line);
+                save_snapshot_copy(snapshot, left.data, left.count);
+                save_snapshot_copy(snapshot, right.data, right.count);
             }
         }
+        if (snapshot->ranges_count > EDITOR_PATCH_MAX_RANGES) {
+            return false;
+        }
+        prev_dirty = line_dirty;
+        offset += line->size;
+    }
+    snapshot->file_size = offset;
+    editor->first_dirty_row = SIZE_MAX;
+    return true;
+}
+
+// Patches the loaded file in place if it can (see editor_snapshot_patch()),
+// otherwise takes the whole document
+static void editor_snapshot(Editor *editor, const char *filepath, Save_Snapshot *snapshot)
+{
+    SPAN("editor_snapshot");
+    // Saving over the loaded file does not touch the mapping: the new file
+    // is renamed over it and the mapped one lives on until it is unmapped.
+    // The lines that are still being indexed are part of the document too,
+    // and so are the edits of the earlier session
+    editor_journal_wait(editor);
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    if (editor_can_patch(editor, filepath)) {
+        if (editor_snapshot_patch(editor, snapshot)) {
+            return;
+        }
+        save_snapshot_free(snapshot);
+        memset(snapshot, 0, sizeof(*snapshot));
+    }
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        editor_snapshot_lines(editor, snapshot);
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE: {
+        editor_snapshot_pt(&editor->pt, snapshot);
+    } break;
+    case EDITOR_BACKEND_ROPE: {
+        // The leaves of the rope are edited in place, so all of it is copied
+        editor_doc_visit(editor, 0, editor_doc_size(editor), editor_snapshot_copy_chunk, snapshot);
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+// Remembers how the patched file looks now, so that the next save can
+// tell whether it is still the one the editor wrote. If the patch failed
+// nobody knows what is in the file, so it is never patched again.
+static void editor_patch_finish(Editor *editor, int error, const struct stat *after)
+{
+    if (error == 0) {
+        editor->mapping_mtime = after->st_mtim;
+        editor->mapping_file_size = after->st_size;
+    } else {
+        memset(&editor->mapping_mtime, 0, sizeof(editor->mapping_mtime));
+    }
+}
+
+// Journals the rows of the lines split into rows that loading the saved
+// file would not split the same way, see JOURNAL_LAYOUT. Loading makes
+// every row of a line full but the last, which is only empty if it is the
+// only one.
+static void editor_journal_layout(Editor *editor)
+{
+    if (editor->backend != EDITOR_BACKEND_LINES || !editor->split_lines) {
+        return;
+    }
+    size_t begin = 0;
+    while (begin < editor->size) {
+        size_t end = begin + 1;
+        while (end < editor->size && editor->lines[end].continued) {
+            end += 1;
+        }
+        bool loaded = true;
+        for (size_t row = begin; row < end && loaded; ++row) {
+            const size_t size = editor->lines[row].size;
+            loaded = row + 1 < end ? size == LINE_MAX_SIZE : size > 0 || row == begin;
+        }
+        for (size_t row = begin; row < end && !loaded; ++row) {
+            journal_layout(&editor->journal, row, row > begin, row + 1 == end, editor->lines[row].size);
+        }
+        begin = end;
+    }
+}
+
+// Marks the snapshot just taken in the crash journal, if it is of the
+// journaled file
+static void editor_save_checkpoint(Editor *editor, const char *filepath)
+{
+    editor->save_journaled = editor->journal.path != NULL
+                             && strcmp(filepath, editor->journal.file_path) == 0;
+    if (editor->save_journaled) {
+        editor->save_checkpoint = journal_checkpoint(&editor->journal);
+        editor_journal_layout(editor);
+    }
+}
+
+// `patched` is the file after a patch, NULL if the save was not one
+static void editor_save_finish(Editor *editor, int error, const struct stat *patched)
+{
+    if (patched != NULL) {
+        editor_patch_finish(editor, error, patched);
+    }
+    struct stat st;
+    if (editor->save_journaled && error == 0 && stat(editor->journal.file_path, &st) == 0) {
+        journal_saved(&editor->journal, editor->save_checkpoint, &st);
+        // Nothing was edited since the checkpoint, and the journal started
+        // over from it without what followed it
+        if (editor->journal.clean) {
+            editor_journal_layout(editor);
+        }
+    }
+    editor->save_journaled = false;
+}
+
+// Saves on the calling thread. Prints the error and returns false if the
+// file could not be written.
+bool editor_save_to_file(Editor *editor, const char *filepath)
+{
+    SPAN("editor_save_to_file");
+    // A background save must not land on top of this one
+    int error = 0;
+    editor_save_wait(editor, &error);
+
+    // Undo steps do not reach across a save
+    undo_seal(&editor->undo);
+    Save_Snapshot snapshot;
+    editor_snapshot(editor, filepath, &snapshot);
+    editor_save_checkpoint(editor, filepath);
+    Save_Timings timings;
+    if (snapshot.patch) {
+        struct stat after;
+        error = save_patch_write(&snapshot, filepath, editor->save_fsync, &timings, &after);
+        editor_save_finish(editor, error, &after);
+    } else {
+        error = save_snapshot_write(&snapshot, filepath, editor->save_fsync, &timings);
+        editor_save_finish(editor, error, NULL);
+    }
+    save_snapshot_free(&snapshot);
+    if (error != 0) {
+        fprintf(stderr, "ERROR: could not save %s: %s\n", filepath, strerror(error));
+        return false;
+    }
+    return true;
+}
+
+// Takes a snapshot of the document and writes it in the background, so
+// the editor can be used again right away. A save requested while another
+// one is running starts with a fresh snapshot once that one is finished.
+void editor_save_start(Editor *editor, const char *filepath)
+{
+    SPAN("editor_save_start");
+    undo_seal(&editor->undo);
+    if (editor->save.busy) {
+        free(editor->save_pending_path);
+        editor->save_pending_path = strdup(filepath);
+        return;
+    }
+    Save_Snapshot snapshot;
+    editor_snapshot(editor, filepath, &snapshot);
+    editor_save_checkpoint(editor, filepath);
+    save_writer_start(&editor->save, snapshot, filepath, editor->save_fsync);
+}
+
+static void editor_save_start_pending(Editor *editor)
+{
+    char *filepath = editor->save_pending_path;
+    if (filepath != NULL) {
+        editor->save_pending_path = NULL;
+        editor_save_start(editor, filepath);
+        free(filepath);
+    }
+}
+
+// `error` is the errno of a failed save
+Editor_Save_Status editor_save_poll(Editor *editor, int *error)
+{
+    *error = 0;
+    if (!editor->save.busy) {
+        return EDITOR_SAVE_IDLE;
+    }
+    if (!save_writer_poll(&editor->save, error)) {
+        return EDITOR_SAVE_RUNNING;
+    }
+    editor_save_finish(editor, *error, editor->save.patch ? &editor->save.patched : NULL);
+    editor_save_start_pending(editor);
+    return *error == 0 ? EDITOR_SAVE_DONE : EDITOR_SAVE_FAILED;
+}
+
+// Blocks until every requested save is written. Reports the first failure
+// if any of them failed.
+Editor_Save_Status editor_save_wait(Editor *editor, int *error)
+{
+    Editor_Save_Status status = EDITOR_SAVE_IDLE;
+    *error = 0;
+    while (editor->save.busy) {
+        int save_error = 0;
+        save_writer_wait(&editor->save, &save_error);
+        editor_save_finish(editor, save_error, editor->save.patch ? &editor->save.patched : NULL);
+        if (*error == 0) {
+            *error = save_error;
+        }
+        status = *error == 0 ? EDITOR_SAVE_DONE : EDITOR_SAVE_FAILED;
+        editor_save_start_pending(editor);
+    }
+    return status;
+}
+
+// Reads the whole input into a buffer of the size of the file when it is
+// known upfront, otherwise keeps doubling the buffer until EOF.
+static char *editor_read_entire_file(Editor_Loader *loader, size_t *size)
+{
+    SPAN("editor_read_entire_file");
+    // One extra byte so that a complete read already hits EOF
+    size_t capacity = loader->expected > 0 ? loader->expected + 1 : 1024*640;
+    char *data = malloc(capacity);
+    *size = 0;
+    while (!atomic_load(&loader->stop)) {
+        if (*size == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+        size_t chunk = capacity - *size;
+        if (chunk > EDITOR_READ_CHUNK_SIZE) {
+            chunk = EDITOR_READ_CHUNK_SIZE;
+        }
+        const ssize_t n = read(loader->fd, data + *size, chunk);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        *size += (size_t) n;
+        atomic_store(&loader->read, *size);
+    }
+    // Reading a pipe can leave up to half of the buffer unused
+    if (*size > 0 && capacity - *size > 1) {
+        data = realloc(data, *size);
+    }
+    return data;
+}
+
+static void *editor_loader_thread(void *arg)
+{
+    Editor_Loader *loader = arg;
+    size_t size = 0;
+    char *data = editor_read_entire_file(loader, &size);
+    close(loader->fd);
+
+    if (atomic_load(&loader->stop)) {
+        free(data);
+        data = NULL;
+        size = 0;
+    } else {
+        switch (loader->backend) {
+        case EDITOR_BACKEND_LINES:
+            // Indexed by the editor, so the lines come in as they are found
+            break;
+        case EDITOR_BACKEND_PIECE_TABLE: {
+            Line_Index index = {0};
+            line_index_start(&index, data, size);
+            line_index_wait(&index);
+            pt_load(&loader->pt, data, size, index.newlines, index.count);
+            index.newlines = NULL;
+            line_index_free(&index);
+            data = NULL;
+        } break;
+        case EDITOR_BACKEND_ROPE: {
+            rope_load(&loader->rope, data, size);
+            free(data);
+            data = NULL;
+        } break;
+        default:
+            assert(0 && "unreachable");
+        }
+    }
+    loader->data = data;
+    loader->size = size;
+    atomic_store(&loader->done, true);
+    return NULL;
+}
+
+// Falls back to reading on the calling thread if no thread can be started
+static void editor_loader_start(Editor *editor, FILE *file)
+{
+    Editor_Loader *loader = &editor->loader;
+    memset(loader, 0, sizeof(*loader));
+    loader->backend = editor->backend;
+    // The file itself is closed by the caller right away
+    loader->fd = dup(fileno(file));
+    struct stat st;
+    if (fstat(loader->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        loader->expected = st.st_size;
+    }
+    loader->running = true;
+    if (pthread_create(&loader->thread, NULL, editor_loader_thread, loader) != 0) {
+        loader->running = false;
+        editor_loader_thread(loader);
+    }
+}
+
+// Takes over what the loader has read and built. Returns false once there
+// is nothing left to take over, which is right away if `wait`.
+static bool editor_loader_finish(Editor *editor, bool wait)
+{
+    Editor_Loader *loader = &editor->loader;
+    if (loader->running) {
+        if (!wait && !atomic_load(&loader->done)) {
+            return true;
+        }
+        pthread_join(loader->thread, NULL);
+        loader->running = false;
+    }
+    if (!atomic_load(&loader->done)) {
+        return false;
+    }
+    switch (loader->backend) {
+    case EDITOR_BACKEND_LINES: {
+        // Pipes and the like are read into a single arena block, which
+        // the lines then borrow from the same way they do from a mapping
+        line_arena_push(&editor->arena, loader->data);
+        line_index_start(&editor->index, loader->data, loader->size);
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE: {
+        pt_free(&editor->pt);
+        editor->pt = loader->pt;
+    } break;
+    case EDITOR_BACKEND_ROPE: {
+        rope_free(&editor->rope);
+        editor->rope = loader->rope;
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+    memset(loader, 0, sizeof(*loader));
+    return false;
+}
+
+// Throws away whatever the loader is still reading
+static void editor_loader_stop(Editor *editor)
+{
+    Editor_Loader *loader = &editor->loader;
+    if (loader->running) {
+        atomic_store(&loader->stop, true);
+        pthread_join(loader->thread, NULL);
+    }
+    free(loader->data);
+    pt_free(&loader->pt);
+    rope_free(&loader->rope);
+    memset(loader, 0, sizeof(*loader));
+}
+
+// Maps a regular file into memory and makes every line a view into the
+// mapping as soon as the background index finds it, so opening the file
+// copies nothing. Fails for anything mmap() does not support, like pipes
+// and empty files.
+static bool editor_map_file(Editor *editor, FILE *file)
+{
+    const int fd = fileno(file);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return false;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    editor->mapping = data;
+    editor->mapping_size = st.st_size;
+    editor->mapping_dev = st.st_dev;
+    editor->mapping_ino = st.st_ino;
+    editor->mapping_mtime = st.st_mtim;
+    editor->mapping_file_size = st.st_size;
+    editor->first_dirty_row = SIZE_MAX;
+    line_index_start(&editor->index, data, st.st_size);
+    editor_load_poll(editor);
+    return true;
+}
+
+bool editor_load_poll(Editor *editor)
+{
+    if (editor_loader_finish(editor, false)) {
+        return true;
+    }
+    Line_Index *index = &editor->index;
+    if (index->data == NULL) {
+        return false;
+    }
+
+    // Only lines whose end is known are published, so the very last line
+    // has to wait for the whole index.
+    const bool indexed = line_index_poll(index);
+    const size_t total = index->count + (indexed ? 1 : 0);
+    size_t available = total;
+    if (available - editor->index_published > EDITOR_PUBLISH_BATCH) {
+        available = editor->index_published + EDITOR_PUBLISH_BATCH;
+    }
+
+    editor_grow(editor, available - editor->index_published);
+    for (size_t i = editor->index_published; i < available; ++i) {
+        size_t begin = i == 0 ? 0 : index->newlines[i-1] + 1;
+        const size_t end = i < index->count ? index->newlines[i] : index->size;
+        bool continued = false;
+        while (end - begin > LINE_MAX_SIZE) {
+            editor_grow(editor, available - i + 1);
+            editor->lines[editor->size] = line_borrow(index->data + begin, LINE_MAX_SIZE);
+            editor->lines[editor->size++].continued = continued;
+            begin += LINE_MAX_SIZE;
+            continued = true;
+            editor->split_lines = true;
+        }
+        editor->lines[editor->size] = line_borrow(index->data + begin, end - begin);
+        editor->lines[editor->size++].continued = continued;
+    }
+    editor->index_published = available;
+
+    if (indexed && available == total) {
+        line_index_free(index);
+        return false;
+    }
+    return true;
+}
+
+void editor_load_wait(Editor *editor)
+{
+    editor_loader_finish(editor, true);
+    while (editor_load_poll(editor)) {
+        line_index_wait(&editor->index);
+    }
+}
+
+// Whether the file is still coming in, which editor_load_poll() tells
+// without polling
+bool editor_loading(const Editor *editor)
+{
+    return editor->loader.running || atomic_load(&editor->loader.done)
+           || editor->index.data != NULL;
+}
+
+// Whether the document can be edited without waiting for the load to
+// finish. The lines backend can be edited as soon as its first lines are
+// there, the piece table and the rope only once they are complete. None
+// of them before editor_journal_poll() replayed the earlier session.
+bool editor_editable(const Editor *editor)
+{
+    if (editor->replay.data != NULL) {
+        return false;
+    }
+    if (!editor_loading(editor)) {
+        return true;
+    }
+    return editor->backend == EDITOR_BACKEND_LINES && editor->size > 0;
+}
+
+// How much of the file is loaded, from 0 to 1. Negative while a file of
+// unknown size is still being read.
+float editor_load_progress(const Editor *editor)
+{
+    const Editor_Loader *loader = &editor->loader;
+    if (loader->running || atomic_load(&loader->done)) {
+        if (loader->expected == 0) {
+            return -1.0f;
+        }
+        return (float) ((double) atomic_load(&loader->read)/loader->expected);
+    }
+    const Line_Index *index = &editor->index;
+    if (index->data == NULL || index->size == 0) {
+        return 1.0f;
+    }
+    // Up to the end of the last published line
+    size_t published = 0;
+    if (editor->index_published > index->count) {
+        published = index->size;
+    } else if (editor->index_published > 0) {
+        published = index->newlines[editor->index_published - 1] + 1;
+    }
+    return (float) ((double) published/index->size);
+}
+
+// The whole mapping is copied into the arena with a single memcpy() and
+// the lines that still point into it are moved over, instead of giving
+// every line a buffer of its own.
+void editor_unmap(Editor *editor)
+{
+    if (editor->mapping == NULL) {
+        return;
+    }
+    // A save in progress may still be reading from the mapping
+    int error = 0;
+    editor_save_wait(editor, &error);
+    editor_load_wait(editor);
+    // Past the end of a file that was patched to be shorter the mapping
+    // can not be read anymore, but no line points there either
+    size_t size = editor->mapping_size;
+    if (size > editor->mapping_file_size) {
+        size = editor->mapping_file_size;
+    }
+    char *copy = malloc(size);
+    memcpy(copy, editor->mapping, size);
+    line_arena_push(&editor->arena, copy);
+    const char *const mapping_end = editor->mapping + size;
+    for (size_t row = 0; row < editor->size; ++row) {
+        Line *line = &editor->lines[row];
+        if (line->storage == LINE_BORROWED
+                && line->es >= editor->mapping && line->es <= mapping_end) {
+            line->es = copy + (line->es - editor->mapping);
+        }
+    }
+    munmap(editor->mapping, editor->mapping_size);
+    editor->mapping = NULL;
+    editor->mapping_size = 0;
+    memset(&editor->mapping_mtime, 0, sizeof(editor->mapping_mtime));
+}
+
+// Releases everything the editor owns and leaves it empty, keeping only
+// the choice of the backend
+void editor_free(Editor *editor)
+{
+    int error = 0;
+    editor_save_wait(editor, &error);
+    editor_loader_stop(editor);
+    line_index_free(&editor->index);
+    for (size_t row = 0; row < editor->size; ++row) {
+        if (editor->lines[row].storage == LINE_OWNED) {
+            free(editor->lines[row].es);
+        }
+    }
+    journal_close(&editor->journal);
+    journal_reader_close(&editor->replay);
+    free(editor->lines);
+    line_arena_free(&editor->arena);
+    undo_free(&editor->undo);
+    if (editor->mapping != NULL) {
+        munmap(editor->mapping, editor->mapping_size);
+    }
+    pt_free(&editor->pt);
+    rope_free(&editor->rope);
+
+    const Editor_Backend backend = editor->backend;
+    memset(editor, 0, sizeof(*editor));
+    editor->backend = backend;
+}
+
+void editor_load_from_file(Editor *editor, FILE *file)
+{
+    SPAN("editor_load_from_file");
+    switch (editor->backend) {
+    case EDITOR_BACKEND_LINES: {
+        assert(editor->lines == NULL && "you can only load files into an empty editor");
+        if (editor_map_file(editor, file)) {
+            break;
+        }
+        editor_loader_start(editor, file);
+        editor_load_poll(editor);
+    } break;
+    case EDITOR_BACKEND_PIECE_TABLE:
+    case EDITOR_BACKEND_ROPE: {
+        editor_loader_start(editor, file);
+    } break;
+    default:
+        assert(0 && "unreachable");
     }
 
     editor->cursor_row = 0;
 }
 
+// JOURNAL //
+
+// Splits and joins the rows of a line until `row` holds `size` bytes, see
+// JOURNAL_LAYOUT. Whatever is left over goes to the next row of the line.
+static bool editor_replay_layout(Editor *editor, size_t row, bool continued, bool last, size_t size)
+{
+    if (editor->backend != EDITOR_BACKEND_LINES || row > editor->size || size > LINE_MAX_SIZE
+            || (continued && row == 0)) {
+        return false;
+    }
+    // The rows before took all of the line, and this one is empty
+    if (continued && (row == editor->size || !editor->lines[row].continued)) {
+        editor_split_row(editor, row - 1, editor->lines[row - 1].size);
+    }
+    if (row == editor->size || editor->lines[row].continued != continued) {
+        return false;
+    }
+    if (editor->lines[row].size > size) {
+        editor_split_row(editor, row, size);
+    }
+    while (editor->lines[row].size < size) {
+        if (row + 1 >= editor->size || !editor->lines[row + 1].continued) {
+            return false;
+        }
+        const size_t missing = size - editor->lines[row].size;
+        if (editor->lines[row + 1].size > missing) {
+            editor_split_row(editor, row + 1, missing);
+        }
+        editor_apply_join_line(editor, row);
+    }
+    while (last && row + 1 < editor->size && editor->lines[row + 1].continued) {
+        if (editor->lines[row + 1].size > 0) {
+            return false;
+        }
+        editor_apply_remove_line(editor, row);
+    }
+    return true;
+}
+
+// Applies a recovered edit, if it fits the document
+static bool editor_replay(Editor *editor, const Journal_Record *record)
+{
+    const size_t lines = editor_line_count(editor);
+    const size_t row = record->row;
+    if (editor->backend == EDITOR_BACKEND_LINES && row < lines) {
+        editor->cursor_row = row;
+        editor_mark_dirty(editor);
+    }
+    switch (record->kind) {
+    case JOURNAL_INSERT: {
+        if (row >= lines || record->col > editor_row_size(editor, row)) {
+            return false;
+        }
+        size_t insert_row = row;
+        size_t insert_col = record->col;
+        editor_apply_insert(editor, &insert_row, &insert_col, record->text, record->count);
+    } break;
+    case JOURNAL_ERASE: {
+        if (row >= lines || record->col > editor_row_size(editor, row)
+                || record->count > editor_row_size(editor, row) - record->col) {
+            return false;
+        }
+        editor_apply_erase(editor, row, record->col, record->count);
+    } break;
+    case JOURNAL_NEW_LINE: {
+        if (row >= lines) {
+            return false;
+        }
+        editor_apply_new_line(editor, row);
+    } break;
+    case JOURNAL_REMOVE_LINE: {
+        if (row + 1 >= lines || editor_row_size(editor, row + 1) != 0) {
+            return false;
+        }
+        editor_apply_remove_line(editor, row);
+    } break;
+    case JOURNAL_JOIN_LINE: {
+        if (editor->backend != EDITOR_BACKEND_LINES || row + 1 >= lines || !editor->lines[row + 1].continued
+                || editor->lines[row].size + editor->lines[row + 1].size > LINE_MAX_SIZE) {
+            return false;
+        }
+        editor_apply_join_line(editor, row);
+    } break;
+    case JOURNAL_LAYOUT: {
+        return editor_replay_layout(editor, row, (record->col & 2) != 0, (record->col & 1) != 0, record->count);
+    } break;
+    case JOURNAL_CHECKPOINT:
+    case JOURNAL_SAVED:
+        break;
+    case COUNT_JOURNAL_KINDS:
+    default:
+        assert(0 && "unreachable");
+    }
+    return true;
+}
+
+// Journals the edits made to `file_path`, after those an earlier session
+// journaled since it last saved it, which editor_journal_poll() replays.
+// The journal only applies to the file exactly as that session saved it.
+// One that does not is moved aside to `.name.journal.old` instead.
+void editor_journal_open(Editor *editor, const char *file_path)
+{
+    SPAN("editor_journal_open");
+    // A file that does not exist yet is identified by zeros
+    struct stat st = {0};
+    if (stat(file_path, &st) < 0) {
+        memset(&st, 0, sizeof(st));
+    }
+    const Journal_File_Id file = journal_file_id(&st);
+    char *path = journal_path_for(file_path);
+
+    bool append = false;
+    size_t next_checkpoint = 0;
+    Journal_Reader reader;
+    if (journal_reader_open(&reader, path)) {
+        // The edits to replay follow the checkpoint that was last saved as
+        // the file on disk. A save finishes after the edits made while it
+        // was written, so its checkpoint is looked up by id.
+        struct { size_t id; size_t pos; } *checkpoints = NULL;
+        size_t checkpoints_count = 0;
+        size_t checkpoints_capacity = 0;
+        size_t start = SIZE_MAX;
+        size_t edits = 0;
+        Journal_Record record;
+        while (journal_read(&reader, &record)) {
+            if (record.kind == JOURNAL_CHECKPOINT) {
+                if (checkpoints_count >= checkpoints_capacity) {
+                    checkpoints_capacity = checkpoints_capacity == 0 ? 16 : checkpoints_capacity*2;
+                    checkpoints = realloc(checkpoints, checkpoints_capacity*sizeof(checkpoints[0]));
+                }
+                checkpoints[checkpoints_count].id = record.id;
+                checkpoints[checkpoints_count].pos = reader.pos;
+                checkpoints_count += 1;
+                if (record.id >= next_checkpoint) {
+                    next_checkpoint = record.id + 1;
+                }
+            } else if (record.kind == JOURNAL_SAVED) {
+                if (journal_file_id_equal(record.file, file)) {
+                    for (size_t i = checkpoints_count; i-- > 0;) {
+                        if (checkpoints[i].id == record.id) {
+                            start = checkpoints[i].pos;
+                            break;
+                        }
+                    }
+                }
+            } else if (record.kind != JOURNAL_LAYOUT) {
+                edits += 1;
+            }
+        }
+        free(checkpoints);
+
+        if (start != SIZE_MAX) {
+            reader.pos = start;
+            editor->replay = reader;
+            append = true;
+        } else if (edits > 0) {
+            char *old_path = malloc(strlen(path) + sizeof(".old"));
+            sprintf(old_path, "%s.old", path);
+            if (rename(path, old_path) == 0) {
+                fprintf(stderr, "WARNING: %s was changed since %s was written, moved it to %s\n",
+                        file_path, path, old_path);
+            }
+            free(old_path);
+        }
+        if (!append) {
+            journal_reader_close(&reader);
+        }
+    }
+    free(path);
+
+    // Edits that could not be journaled again stay in the journal for the
+    // next session
+    if (!journal_open(&editor->journal, file_path, &st, append, next_checkpoint)) {
+        journal_reader_close(&editor->replay);
+    }
+}
+
+// Replays the edits found by editor_journal_open() once the file is
+// loaded. Returns how many were recovered on the call that replayed them
+// and 0 on every other.
+size_t editor_journal_poll(Editor *editor)
+{
+    if (editor->replay.data == NULL || editor->replaying || editor_loading(editor)) {
+        return 0;
+    }
+    SPAN("editor_journal_poll");
+    // The edits are in the journal already and are not journaled again
+    editor->replaying = true;
+    size_t recovered = 0;
+    bool created = false;
+    Journal_Record record;
+    while (journal_read(&editor->replay, &record)) {
+        if (!created && record.kind != JOURNAL_CHECKPOINT && record.kind != JOURNAL_SAVED) {
+            editor_create_first_line(editor);
+            created = true;
+        }
+        if (!editor_replay(editor, &record)) {
+            fprintf(stderr, "ERROR: %s: edit %zu does not fit %s, the rest is not recovered\n",
+                    editor->journal.path, recovered + 1, editor->journal.file_path);
+            break;
+        }
+        if (record.kind != JOURNAL_CHECKPOINT && record.kind != JOURNAL_SAVED
+                && record.kind != JOURNAL_LAYOUT) {
+            recovered += 1;
+        }
+    }
+    journal_reader_close(&editor->replay);
+    editor->replaying = false;
+    editor->cursor_row = 0;
+    editor->cursor_col = 0;
+    if (recovered == 0) {
+        editor->journal.clean = true;
+    }
+    return recovered;
+}
+
+// Waits for the file to load and replays the journal over it, see
+// editor_journal_poll()
+size_t editor_journal_wait(Editor *editor)
+{
+    editor_load_wait(editor);
+    return editor_journal_poll(editor);
+}
+
+// Writes out the journal and removes it if everything was saved
+void editor_journal_close(Editor *editor)
+{
+    int error = 0;
+    editor_save_wait(editor, &error);
+    journal_close(&editor->journal);
+}
+
 #endif // EDITOR_IMPLEMENTATIO
 
 #endif // EDITOR_H_
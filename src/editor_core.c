@@ -0,0 +1,36 @@
+// The editing engine on its own: lines, piece table, rope, loading, saving
+// and input traces, without any SDL or OpenGL. `make core` builds it into
+// libeditor.a, which the editor links against and which can be driven
+// headless by benchmarks and batch tools.
+#define _DEFAULT_SOURCE // fileno(), mmap()
+
+// Included by the other headers, so it has to come first
+#define SPANS_IMPLEMENTATION
+#include "spans.h"
+
+#define LINE_INDEX_IMPLEMENTATION
+#include "line_index.h"
+
+#define PIECE_TABLE_IMPLEMENTATION
+#include "piece_table.h"
+
+#define ROPE_IMPLEMENTATION
+#include "rope.h"
+
+#define SAVE_IMPLEMENTATION
+#include "save.h"
+
+#define UNDO_IMPLEMENTATION
+#include "undo.h"
+
+#define JOURNAL_IMPLEMENTATION
+#include "journal.h"
+
+#define EDITOR_IMPLEMENTATION
+#include "editor.h"
+
+#define TRACE_IMPLEMENTATION
+#include "trace.h"
+
+#define SV_IMPLEMENTATION
+#include "sv.h"
@@ -8,6 +8,7 @@
 
 #define FILE_IMPLEMENTATION
 #include "file.h"
+#include "spans.h"
 
 const char *shader_type_as_cstr(GLuint shader);
 
@@ -51,6 +52,7 @@ bool compile_shader_source(const GLchar *source, GLenum shader_type, GLuint *sha
 
 bool compile_shader_file(const char *file_path, GLenum shader_type, GLuint *shader)
 {
+    SPAN("compile_shader_file");
     char *source = slurp_file(file_path);
 
     bool ok = compile_shader_source(source, shader_type, shader);
@@ -63,6 +65,7 @@ bool compile_shader_file(const char *file_path, GLenum shader_type, GLuint *shad
 
 bool link_program(GLuint vert_shader, GLuint frag_shader, GLuint *program)
 {
+    SPAN("link_program");
     *program = glCreateProgram();
     glAttachShader(*program, vert_shader);
     glAttachShader(*program, frag_shader);
@@ -2,6 +2,14 @@
 #ifndef GLYPH_H_
 #define GLYPH_H_
 
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spans.h"
+
 #define FONT_WIDTH 128.f
 #define FONT_HEIGHT 64.f
 #define FONT_ROWS 7
@@ -11,83 +19,240 @@
 
 // TODO: this header file depends on "vec.h"
 
+// Colors are looked up in a small palette uploaded once as a uniform
+typedef enum {
+    GLYPH_COLOR_TEXT = 0,
+    GLYPH_COLOR_CURSOR,
+    GLYPH_COLOR_CURSOR_TEXT,
+    // The profiler overlay
+    GLYPH_COLOR_PANEL,
+    GLYPH_COLOR_RED,
+    GLYPH_COLOR_GREEN,
+    GLYPH_COLOR_BLUE,
+    GLYPH_COLOR_YELLOW,
+    COUNT_GLYPH_COLORS,
+} Glyph_Color;
+
+static const Vec4f glyph_palette[COUNT_GLYPH_COLORS] = {
+    [GLYPH_COLOR_TEXT]        = {.x = 1.0f, .y = 1.0f, .z = 1.0f, .t = 1.0f},
+    [GLYPH_COLOR_CURSOR]      = {.x = 1.0f, .y = 1.0f, .z = 1.0f, .t = 1.0f},
+    [GLYPH_COLOR_CURSOR_TEXT] = {.x = 0.0f, .y = 0.0f, .z = 0.0f, .t = 1.0f},
+    [GLYPH_COLOR_PANEL]       = {.x = 0.0f, .y = 0.0f, .z = 0.0f, .t = 0.75f},
+    [GLYPH_COLOR_RED]         = {.x = 1.0f, .y = 0.3f, .z = 0.3f, .t = 1.0f},
+    [GLYPH_COLOR_GREEN]       = {.x = 0.3f, .y = 1.0f, .z = 0.3f, .t = 1.0f},
+    [GLYPH_COLOR_BLUE]        = {.x = 0.3f, .y = 0.5f, .z = 1.0f, .t = 1.0f},
+    [GLYPH_COLOR_YELLOW]      = {.x = 1.0f, .y = 1.0f, .z = 0.3f, .t = 1.0f},
+};
+
+// One character cell of the monospace grid. The cell is relative to the
+// top left visible cell, whose position on the screen, the size of the
+// cells and the palette are uniforms, so a glyph is just 8 bytes.
 typedef struct {
-    Vec2f pos;   
-    float scale;
-    float ch;
-    Vec4f color;
+    int16_t col;
+    int16_t row;
+    uint8_t ch;
+    uint8_t color;
+    // Keeps every instance 4 byte aligned
+    uint16_t unused;
 } Glyph;
 
+static_assert(sizeof(Glyph) == 8, "Glyph is supposed to be packed into 8 bytes");
+
 typedef enum {
-    GLYPH_ATTR_POS = 0,
-    GLYPH_ATTR_SCALE,
+    GLYPH_ATTR_CELL = 0,
     GLYPH_ATTR_CH,
     GLYPH_ATTR_COLOR,
     COUNT_GLYPH_ATTRS,
 } Glyph_Attr;
 
+// All of the attributes are integers and are passed to the shader
+// as is with glVertexAttribIPointer()
 typedef struct {
     size_t offset;
     size_t comps;
+    GLenum type;
 } Glyph_Attr_Def;
 
 static const Glyph_Attr_Def glyph_attr_defs[COUNT_GLYPH_ATTRS] = {
-    [GLYPH_ATTR_POS]   = {
-        .offset = offsetof(Glyph, pos),
+    [GLYPH_ATTR_CELL]  = {
+        .offset = offsetof(Glyph, col),
         .comps = 2,
-    },
-    [GLYPH_ATTR_SCALE] = {
-        .offset = offsetof(Glyph, scale),
-        .comps = 1,
+        .type = GL_SHORT,
     },
     [GLYPH_ATTR_CH]    = {
         .offset = offsetof(Glyph, ch),
         .comps = 1,
+        .type = GL_UNSIGNED_BYTE,
     },
     [GLYPH_ATTR_COLOR] = {
         .offset = offsetof(Glyph, color),
-        .comps = 4,
+        .comps = 1,
+        .type = GL_UNSIGNED_BYTE,
     },
 };
 
-static_assert(COUNT_GLYPH_ATTRS == 4, "The amout of glyph vertex attributes have changed");
+static_assert(COUNT_GLYPH_ATTRS == 3, "The amout of glyph vertex attributes have changed");
 
-#define GLYPH_BUFFER_CAP 1024
+// Glyphs with this character are drawn as a solid rectangle of their
+// color instead of being looked up in the font. Keep in sync with font.vert.
+#define GLYPH_SOLID 127
+// Text bytes outside of this range are drawn as '?', so that a DEL in a
+// document never turns into GLYPH_SOLID. Keep in sync with font.vert.
+#define GLYPH_DISPLAY_LOW 32
+#define GLYPH_DISPLAY_HIGH 126
 
-Glyph glyph_buffer[GLYPH_BUFFER_CAP];
+#define GLYPH_BUFFER_INIT_CAPACITY 1024
+// How many glyphs the GPU side stream buffer starts with and how big it
+// is allowed to grow. Frames with more glyphs than that are drawn in
+// several batches.
+#define GLYPH_STREAM_INIT_CAPACITY (16*1024)
+#define GLYPH_STREAM_MAX_CAPACITY (256*1024)
+
+// Glyphs of the current frame. Grows as needed on the CPU side and is
+// streamed to the GPU on glyph_buffer_flush().
+extern Glyph *glyph_buffer;
+extern size_t glyph_buffer_count;
+extern size_t glyph_buffer_capacity;
+
+void glyph_buffer_init(void);
+void glyph_buffer_push(Glyph glyph);
+void glyph_buffer_clear(void);
+void glyph_buffer_flush(void);
+
+void ogl_render_text(const char *text, size_t text_size, int col, int row, Glyph_Color color);
+
+#ifdef GLYPH_IMPLEMENTATION
+
+Glyph *glyph_buffer = NULL;
 size_t glyph_buffer_count = 0;
+size_t glyph_buffer_capacity = 0;
+
+// The GPU buffer is used as a stream: every batch is written right after
+// the previous one without waiting for the GPU to finish reading it.
+// When the buffer runs out it is orphaned, so the driver hands out fresh
+// storage while the draws that still use the old one are in flight.
+static GLuint glyph_stream_vao = 0;
+static GLuint glyph_stream_vbo = 0;
+static size_t glyph_stream_capacity = 0;
+static size_t glyph_stream_offset = 0;
+
+static void glyph_stream_orphan(size_t capacity)
+{
+    glyph_stream_capacity = capacity;
+    glyph_stream_offset = 0;
+    glBufferData(GL_ARRAY_BUFFER, glyph_stream_capacity*sizeof(Glyph), NULL, GL_STREAM_DRAW);
+}
+
+// Points the instanced attributes at the glyphs starting at `first`.
+// GL 3.3 has no base instance for instanced draws, so this is how every
+// batch starts from its own place in the stream.
+static void glyph_stream_bind_attrs(size_t first)
+{
+    for (Glyph_Attr attr = 0; attr < COUNT_GLYPH_ATTRS; ++attr) {
+        glVertexAttribIPointer(
+            attr,
+            glyph_attr_defs[attr].comps,
+            glyph_attr_defs[attr].type,
+            sizeof(Glyph),
+            (void*) (first*sizeof(Glyph) + glyph_attr_defs[attr].offset)
+        );
+    }
+}
+
+void glyph_buffer_init(void)
+{
+    glGenVertexArrays(1, &glyph_stream_vao);
+    glBindVertexArray(glyph_stream_vao);
+
+    glGenBuffers(1, &glyph_stream_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, glyph_stream_vbo);
+    glyph_stream_orphan(GLYPH_STREAM_INIT_CAPACITY);
+
+    for (Glyph_Attr attr = 0; attr < COUNT_GLYPH_ATTRS; ++attr) {
+        glEnableVertexAttribArray(attr);
+        glVertexAttribDivisor(attr, 1);
+    }
+    glyph_stream_bind_attrs(0);
+}
 
 void glyph_buffer_push(Glyph glyph)
 {
-    assert(glyph_buffer_count < GLYPH_BUFFER_CAP && "Glyph buffer overflow");
+    if (glyph_buffer_count >= glyph_buffer_capacity) {
+        size_t new_capacity = glyph_buffer_capacity;
+        if (new_capacity == 0) {
+            new_capacity = GLYPH_BUFFER_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+        glyph_buffer = realloc(glyph_buffer, new_capacity*sizeof(glyph_buffer[0]));
+        glyph_buffer_capacity = new_capacity;
+    }
     glyph_buffer[glyph_buffer_count++] = glyph;
 }
 
-void glyph_buffer_sync(void)
+void glyph_buffer_clear(void)
 {
-    glBufferSubData(GL_ARRAY_BUFFER, 0, glyph_buffer_count * sizeof(Glyph), glyph_buffer);
+    glyph_buffer_count = 0;
 }
 
-void ogl_render_text(const char *text, size_t text_size, Vec2f pos, float scale, Vec4f color)
+// Streams everything pushed so far to the GPU and draws it, usually with
+// a single instanced draw call, then starts over.
+void glyph_buffer_flush(void)
+{
+    SPAN("glyph_buffer_flush");
+    size_t drawn = 0;
+    while (drawn < glyph_buffer_count) {
+        const size_t pending = glyph_buffer_count - drawn;
+        if (glyph_stream_offset + pending > glyph_stream_capacity) {
+            size_t new_capacity = glyph_stream_capacity;
+            while (new_capacity < pending && new_capacity < GLYPH_STREAM_MAX_CAPACITY) {
+                new_capacity = new_capacity*2;
+            }
+            if (new_capacity > GLYPH_STREAM_MAX_CAPACITY) {
+                new_capacity = GLYPH_STREAM_MAX_CAPACITY;
+            }
+            glyph_stream_orphan(new_capacity);
+        }
+
+        size_t batch = glyph_stream_capacity - glyph_stream_offset;
+        if (batch > pending) {
+            batch = pending;
+        }
+        void *dst = glMapBufferRange(
+            GL_ARRAY_BUFFER,
+            glyph_stream_offset*sizeof(Glyph),
+            batch*sizeof(Glyph),
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT
+        );
+        assert(dst != NULL && "Could not map the glyph stream buffer");
+        memcpy(dst, glyph_buffer + drawn, batch*sizeof(Glyph));
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+
+        glyph_stream_bind_attrs(glyph_stream_offset);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batch);
+
+        glyph_stream_offset += batch;
+        drawn += batch;
+    }
+    glyph_buffer_clear();
+}
+
+void ogl_render_text(const char *text, size_t text_size, int col, int row, Glyph_Color color)
 {
-    Vec2f char_size = {0};
     for (size_t i=0; i < text_size; ++i) {
-        vec2f_make(&char_size, FONT_CHAR_WIDTH, FONT_CHAR_HEIGHT);
-        Vec2f new_pos = vec2f_clone(pos);
-        Vec2f scalar = {0};
-        vec2f_make(&scalar, (float)i*scale, 0);
-        vec2f_mul(&char_size, scalar);
-        vec2f_add(&new_pos, char_size);
+        uint8_t ch = (uint8_t) text[i];
+        if (ch < GLYPH_DISPLAY_LOW || ch > GLYPH_DISPLAY_HIGH) {
+            ch = '?';
+        }
         Glyph glyph = {
-            .pos = new_pos,
-            .scale = scale,
-            .ch = (float)text[i],
-            .color = color,
+            .col = (int16_t) (col + (int) i),
+            .row = (int16_t) row,
+            .ch = ch,
+            .color = (uint8_t) color,
         };
         glyph_buffer_push(glyph);
     }
 }
 
-#ifdef GLYPH_IMPLEMENTATION
 #endif // GLYPH_IMPLEMENTATION
 #endif // GLYPH_H_
@@ -0,0 +1,583 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "spans.h"
+
+#define JOURNAL_VERSION 1
+#define JOURNAL_INIT_CAPACITY 4096
+// The writer waits this long for more edits before it writes a batch...
+#define JOURNAL_FLUSH_MS 200
+// ...unless this much is waiting already
+#define JOURNAL_FLUSH_SIZE (1024*1024)
+
+typedef enum {
+    // `text` was inserted at row:col
+    JOURNAL_INSERT = 0,
+    // `count` bytes were removed at row:col
+    JOURNAL_ERASE,
+    // An empty line was inserted after `row`
+    JOURNAL_NEW_LINE,
+    // The empty line after `row` was removed
+    JOURNAL_REMOVE_LINE,
+    // The document at this point was snapshotted for save `id`
+    JOURNAL_CHECKPOINT,
+    // The snapshot of checkpoint `id` is on disk as `file`
+    JOURNAL_SAVED,
+    // The row after `row`, which continues it, was appended to it. Only
+    // made by EDITOR_BACKEND_LINES, which splits long lines into rows.
+    JOURNAL_JOIN_LINE,
+    // Not an edit: at the checkpoint before it, row `row` held `count`
+    // bytes of a line split into rows. Bit 0 of `col` is set on the last
+    // row of the line, bit 1 on the rows that continue the one before.
+    // Loading the saved file splits that line into full rows instead, so
+    // these tell a replay how to get back to the rows of the edits after
+    // the checkpoint. Rows that are like that already stay as they are.
+    JOURNAL_LAYOUT,
+    COUNT_JOURNAL_KINDS,
+} Journal_Kind;
+
+// Tells whether the file on disk is still the one a checkpoint was saved as
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_sec;
+    uint64_t mtime_nsec;
+} Journal_File_Id;
+
+typedef struct {
+    Journal_Kind kind;
+    size_t row;
+    size_t col;
+    // JOURNAL_INSERT, points into the reader
+    const char *text;
+    // The size of `text` or the count of JOURNAL_ERASE
+    size_t count;
+    // JOURNAL_CHECKPOINT and JOURNAL_SAVED
+    size_t id;
+    Journal_File_Id file;
+} Journal_Record;
+
+// A write-ahead log of the edits made to a file since it was last saved,
+// so that they can be replayed on top of it after a crash. Records are
+// encoded on the calling thread and written in batches, followed by an
+// fdatasync(), on a thread of its own.
+//
+//   header: "BNJR", u8 version
+//   record: u8 kind followed by varints: row, col and count plus the text
+//           for JOURNAL_INSERT, row, col, count for JOURNAL_ERASE and
+//           JOURNAL_LAYOUT, row for the lines, id for JOURNAL_CHECKPOINT,
+//           and id, dev, ino, size, mtime seconds and nanoseconds for
+//           JOURNAL_SAVED
+//
+// The journal starts with the checkpoint of the file as it was opened.
+// Once a save finishes with no edits since its checkpoint the journal is
+// truncated back to just that.
+typedef struct {
+    // The journal itself and the file it is about
+    char *path;
+    char *file_path;
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t flushed;
+    // Encoded records the writer did not take yet
+    char *pending;
+    size_t pending_size;
+    size_t pending_capacity;
+    // Everything in the file is replaced by what is pending
+    bool truncate;
+    bool writing;
+    bool stop;
+    // errno of the first failed write, 0 if none failed
+    int error;
+    // Only touched by the thread that makes the edits
+    size_t next_checkpoint;
+    size_t edits;
+    size_t checkpoint_edits;
+    // No edits since the last save that emptied the journal
+    bool clean;
+} Journal;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t pos;
+} Journal_Reader;
+
+char *journal_path_for(const char *file_path);
+Journal_File_Id journal_file_id(const struct stat *st);
+bool journal_file_id_equal(Journal_File_Id a, Journal_File_Id b);
+
+bool journal_open(Journal *journal, const char *file_path, const struct stat *st,
+                  bool append, size_t next_checkpoint);
+void journal_edit(Journal *journal, Journal_Kind kind, size_t row, size_t col,
+                  const char *text, size_t count);
+void journal_layout(Journal *journal, size_t row, bool continued, bool last, size_t size);
+size_t journal_checkpoint(Journal *journal);
+void journal_saved(Journal *journal, size_t id, const struct stat *st);
+void journal_sync(Journal *journal);
+void journal_close(Journal *journal);
+
+bool journal_reader_open(Journal_Reader *reader, const char *path);
+bool journal_read(Journal_Reader *reader, Journal_Record *record);
+void journal_reader_close(Journal_Reader *reader);
+
+#ifdef JOURNAL_IMPLEMENTATION
+
+// `.name.journal` next to the file, like an editor swap file
+char *journal_path_for(const char *file_path)
+{
+    const char *slash = strrchr(file_path, '/');
+    const size_t dir_size = slash ? (size_t) (slash - file_path + 1) : 0;
+    const char *name = file_path + dir_size;
+    const size_t size = dir_size + 1 + strlen(name) + sizeof(".journal");
+    char *path = malloc(size);
+    snprintf(path, size, "%.*s.%s.journal", (int) dir_size, file_path, name);
+    return path;
+}
+
+Journal_File_Id journal_file_id(const struct stat *st)
+{
+    return (Journal_File_Id) {
+        .dev = st->st_dev,
+        .ino = st->st_ino,
+        .size = st->st_size,
+        .mtime_sec = st->st_mtim.tv_sec,
+        .mtime_nsec = st->st_mtim.tv_nsec,
+    };
+}
+
+bool journal_file_id_equal(Journal_File_Id a, Journal_File_Id b)
+{
+    return a.dev == b.dev && a.ino == b.ino && a.size == b.size
+           && a.mtime_sec == b.mtime_sec && a.mtime_nsec == b.mtime_nsec;
+}
+
+static size_t journal_put_varint(char *buffer, uint64_t x)
+{
+    size_t n = 0;
+    while (x >= 0x80) {
+        buffer[n++] = (char) ((x & 0x7f) | 0x80);
+        x >>= 7;
+    }
+    buffer[n++] = (char) x;
+    return n;
+}
+
+static void journal_push(Journal *journal, const char *data, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+    size_t new_capacity = journal->pending_capacity;
+    while (new_capacity - journal->pending_size < size) {
+        if (new_capacity == 0) {
+            new_capacity = JOURNAL_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+    }
+    if (new_capacity != journal->pending_capacity) {
+        journal->pending = realloc(journal->pending, new_capacity);
+        journal->pending_capacity = new_capacity;
+    }
+    memcpy(journal->pending + journal->pending_size, data, size);
+    journal->pending_size += size;
+}
+
+// Hands an encoded record and its text over to the writer
+static void journal_append(Journal *journal, const char *record, size_t record_size,
+                           const char *text, size_t text_size)
+{
+    pthread_mutex_lock(&journal->mutex);
+    const bool idle = journal->pending_size == 0;
+    journal_push(journal, record, record_size);
+    journal_push(journal, text, text_size);
+    if (idle || journal->pending_size >= JOURNAL_FLUSH_SIZE) {
+        pthread_cond_signal(&journal->wake);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+// Where the journal starts over: the header, a checkpoint and the file it
+// was saved as
+static void journal_append_start(Journal *journal, size_t id, const struct stat *st)
+{
+    char record[128] = "BNJR";
+    size_t n = 4;
+    record[n++] = JOURNAL_VERSION;
+    record[n++] = JOURNAL_CHECKPOINT;
+    n += journal_put_varint(record + n, id);
+    const Journal_File_Id file = journal_file_id(st);
+    record[n++] = JOURNAL_SAVED;
+    n += journal_put_varint(record + n, id);
+    n += journal_put_varint(record + n, file.dev);
+    n += journal_put_varint(record + n, file.ino);
+    n += journal_put_varint(record + n, file.size);
+    n += journal_put_varint(record + n, file.mtime_sec);
+    n += journal_put_varint(record + n, file.mtime_nsec);
+    journal_append(journal, record, n, NULL, 0);
+}
+
+static int journal_write_batch(int fd, const char *data, size_t size, bool truncate)
+{
+    SPAN("journal_write_batch");
+    if (truncate && ftruncate(fd, 0) < 0) {
+        return errno;
+    }
+    for (size_t written = 0; written < size;) {
+        const ssize_t n = write(fd, data + written, size - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n < 0 ? errno : EIO;
+        }
+        written += (size_t) n;
+    }
+    return fdatasync(fd) < 0 ? errno : 0;
+}
+
+static void *journal_thread(void *arg)
+{
+    Journal *journal = arg;
+    char *batch = NULL;
+    size_t batch_capacity = 0;
+
+    pthread_mutex_lock(&journal->mutex);
+    for (;;) {
+        while (!journal->stop && journal->pending_size == 0) {
+            pthread_cond_wait(&journal->wake, &journal->mutex);
+        }
+        if (!journal->stop && journal->pending_size < JOURNAL_FLUSH_SIZE) {
+            // Gives the edits that come right after this one a ride
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += JOURNAL_FLUSH_MS*1000000L;
+            deadline.tv_sec += deadline.tv_nsec/1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&journal->wake, &journal->mutex, &deadline);
+        }
+        if (journal->pending_size == 0 && journal->stop) {
+            break;
+        }
+
+        // The buffers are swapped, so the editor never waits for the disk
+        char *data = journal->pending;
+        const size_t data_capacity = journal->pending_capacity;
+        const size_t size = journal->pending_size;
+        const bool truncate = journal->truncate;
+        journal->pending = batch;
+        journal->pending_capacity = batch_capacity;
+        journal->pending_size = 0;
+        journal->truncate = false;
+        journal->writing = true;
+        pthread_mutex_unlock(&journal->mutex);
+
+        const int error = journal_write_batch(journal->fd, data, size, truncate);
+
+        pthread_mutex_lock(&journal->mutex);
+        batch = data;
+        batch_capacity = data_capacity;
+        if (error != 0 && journal->error == 0) {
+            fprintf(stderr, "ERROR: could not write journal %s: %s\n", journal->path, strerror(error));
+            journal->error = error;
+        }
+        journal->writing = false;
+        pthread_cond_broadcast(&journal->flushed);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    free(batch);
+    return NULL;
+}
+
+// Starts journaling the edits of `file_path`, which is on disk as `st`.
+// A journal that was recovered is appended to and keeps its checkpoints.
+bool journal_open(Journal *journal, const char *file_path, const struct stat *st,
+                  bool append, size_t next_checkpoint)
+{
+    memset(journal, 0, sizeof(*journal));
+    journal->path = journal_path_for(file_path);
+    journal->fd = open(journal->path, O_WRONLY | O_CREAT | O_APPEND | (append ? 0 : O_TRUNC), 0600);
+    if (journal->fd < 0) {
+        fprintf(stderr, "ERROR: could not open journal %s: %s\n", journal->path, strerror(errno));
+        free(journal->path);
+        journal->path = NULL;
+        return false;
+    }
+    journal->file_path = strdup(file_path);
+    pthread_mutex_init(&journal->mutex, NULL);
+    pthread_cond_init(&journal->wake, NULL);
+    pthread_cond_init(&journal->flushed, NULL);
+    journal->next_checkpoint = next_checkpoint;
+    journal->clean = !append;
+    if (!append) {
+        journal_append_start(journal, journal->next_checkpoint++, st);
+    }
+    if (pthread_create(&journal->thread, NULL, journal_thread, journal) != 0) {
+        fprintf(stderr, "ERROR: could not start the journal writer\n");
+        close(journal->fd);
+        free(journal->path);
+        free(journal->file_path);
+        free(journal->pending);
+        memset(journal, 0, sizeof(*journal));
+        return false;
+    }
+    return true;
+}
+
+void journal_edit(Journal *journal, Journal_Kind kind, size_t row, size_t col,
+                  const char *text, size_t count)
+{
+    char record[64];
+    size_t n = 0;
+    record[n++] = (char) kind;
+    n += journal_put_varint(record + n, row);
+    switch (kind) {
+    case JOURNAL_INSERT:
+    case JOURNAL_ERASE: {
+        n += journal_put_varint(record + n, col);
+        n += journal_put_varint(record + n, count);
+    } break;
+    case JOURNAL_NEW_LINE:
+    case JOURNAL_REMOVE_LINE:
+    case JOURNAL_JOIN_LINE:
+        break;
+    case JOURNAL_CHECKPOINT:
+    case JOURNAL_SAVED:
+    case JOURNAL_LAYOUT:
+    case COUNT_JOURNAL_KINDS:
+    default:
+        assert(0 && "unreachable");
+    }
+    journal_append(journal, record, n, kind == JOURNAL_INSERT ? text : NULL,
+                   kind == JOURNAL_INSERT ? count : 0);
+    journal->edits += 1;
+    journal->clean = false;
+}
+
+// Follows a checkpoint, see JOURNAL_LAYOUT. Does not count as an edit.
+void journal_layout(Journal *journal, size_t row, bool continued, bool last, size_t size)
+{
+    char record[64];
+    size_t n = 0;
+    record[n++] = JOURNAL_LAYOUT;
+    n += journal_put_varint(record + n, row);
+    n += journal_put_varint(record + n, (continued ? 2 : 0) | (last ? 1 : 0));
+    n += journal_put_varint(record + n, size);
+    journal_append(journal, record, n, NULL, 0);
+}
+
+// Marks the document that is about to be saved to the journaled file.
+// Returns the id to pass to journal_saved() once the save is on disk.
+size_t journal_checkpoint(Journal *journal)
+{
+    const size_t id = journal->next_checkpoint++;
+    char record[16];
+    size_t n = 0;
+    record[n++] = JOURNAL_CHECKPOINT;
+    n += journal_put_varint(record + n, id);
+    journal_append(journal, record, n, NULL, 0);
+    journal->checkpoint_edits = journal->edits;
+    return id;
+}
+
+// The edits up to checkpoint `id` are safe in the file now. If nothing was
+// edited since, the journal has nothing left to recover and starts over.
+void journal_saved(Journal *journal, size_t id, const struct stat *st)
+{
+    if (journal->edits == journal->checkpoint_edits) {
+        pthread_mutex_lock(&journal->mutex);
+        journal->pending_size = 0;
+        journal->truncate = true;
+        pthread_mutex_unlock(&journal->mutex);
+        journal_append_start(journal, id, st);
+        journal->clean = true;
+        return;
+    }
+    const Journal_File_Id file = journal_file_id(st);
+    char record[128];
+    size_t n = 0;
+    record[n++] = JOURNAL_SAVED;
+    n += journal_put_varint(record + n, id);
+    n += journal_put_varint(record + n, file.dev);
+    n += journal_put_varint(record + n, file.ino);
+    n += journal_put_varint(record + n, file.size);
+    n += journal_put_varint(record + n, file.mtime_sec);
+    n += journal_put_varint(record + n, file.mtime_nsec);
+    journal_append(journal, record, n, NULL, 0);
+}
+
+// Blocks until everything appended so far is on disk
+void journal_sync(Journal *journal)
+{
+    pthread_mutex_lock(&journal->mutex);
+    pthread_cond_signal(&journal->wake);
+    while (journal->pending_size > 0 || journal->writing) {
+        pthread_cond_wait(&journal->flushed, &journal->mutex);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+// Writes out what is left. A clean journal has nothing worth recovering
+// and is removed.
+void journal_close(Journal *journal)
+{
+    if (journal->path == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&journal->mutex);
+    journal->stop = true;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->mutex);
+    pthread_join(journal->thread, NULL);
+    close(journal->fd);
+    if (journal->clean && journal->error == 0) {
+        unlink(journal->path);
+    }
+    pthread_mutex_destroy(&journal->mutex);
+    pthread_cond_destroy(&journal->wake);
+    pthread_cond_destroy(&journal->flushed);
+    free(journal->pending);
+    free(journal->path);
+    free(journal->file_path);
+    memset(journal, 0, sizeof(*journal));
+}
+
+// Returns false if there is no journal or it is not one
+bool journal_reader_open(Journal_Reader *reader, const char *path)
+{
+    memset(reader, 0, sizeof(*reader));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    size_t capacity = JOURNAL_INIT_CAPACITY;
+    reader->data = malloc(capacity);
+    for (;;) {
+        reader->size += fread(reader->data + reader->size, 1, capacity - reader->size, file);
+        if (reader->size < capacity) {
+            break;
+        }
+        capacity *= 2;
+        reader->data = realloc(reader->data, capacity);
+    }
+    fclose(file);
+
+    if (reader->size < 5 || memcmp(reader->data, "BNJR", 4) != 0
+            || reader->data[4] != JOURNAL_VERSION) {
+        journal_reader_close(reader);
+        return false;
+    }
+    reader->pos = 5;
+    return true;
+}
+
+static bool journal_read_varint(Journal_Reader *reader, uint64_t *x)
+{
+    *x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (reader->pos >= reader->size) {
+            return false;
+        }
+        const unsigned char b = reader->data[reader->pos++];
+        *x |= (uint64_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool journal_read_size(Journal_Reader *reader, size_t *x)
+{
+    uint64_t value = 0;
+    if (!journal_read_varint(reader, &value) || value > SIZE_MAX) {
+        return false;
+    }
+    *x = (size_t) value;
+    return true;
+}
+
+// Returns false at the end of the journal. A truncated last record, which
+// is what a crash in the middle of a write leaves behind, is the end too.
+bool journal_read(Journal_Reader *reader, Journal_Record *record)
+{
+    memset(record, 0, sizeof(*record));
+    if (reader->pos >= reader->size) {
+        return false;
+    }
+    const unsigned char kind = reader->data[reader->pos++];
+    if (kind >= COUNT_JOURNAL_KINDS) {
+        return false;
+    }
+    record->kind = (Journal_Kind) kind;
+    switch (record->kind) {
+    case JOURNAL_INSERT:
+    case JOURNAL_ERASE:
+    case JOURNAL_LAYOUT: {
+        if (!journal_read_size(reader, &record->row) || !journal_read_size(reader, &record->col)
+                || !journal_read_size(reader, &record->count)) {
+            return false;
+        }
+        if (record->kind == JOURNAL_INSERT) {
+            if (record->count > reader->size - reader->pos) {
+                return false;
+            }
+            record->text = reader->data + reader->pos;
+            reader->pos += record->count;
+        }
+    } break;
+    case JOURNAL_NEW_LINE:
+    case JOURNAL_REMOVE_LINE:
+    case JOURNAL_JOIN_LINE: {
+        if (!journal_read_size(reader, &record->row)) {
+            return false;
+        }
+    } break;
+    case JOURNAL_CHECKPOINT: {
+        if (!journal_read_size(reader, &record->id)) {
+            return false;
+        }
+    } break;
+    case JOURNAL_SAVED: {
+        Journal_File_Id *file = &record->file;
+        if (!journal_read_size(reader, &record->id)
+                || !journal_read_varint(reader, &file->dev) || !journal_read_varint(reader, &file->ino)
+                || !journal_read_varint(reader, &file->size) || !journal_read_varint(reader, &file->mtime_sec)
+                || !journal_read_varint(reader, &file->mtime_nsec)) {
+            return false;
+        }
+    } break;
+    case COUNT_JOURNAL_KINDS:
+    default:
+        assert(0 && "unreachable");
+    }
+    return true;
+}
+
+void journal_reader_close(Journal_Reader *reader)
+{
+    free(reader->data);
+    memset(reader, 0, sizeof(*reader));
+}
+
+#endif // JOURNAL_IMPLEMENTATION
+#endif // JOURNAL_H_
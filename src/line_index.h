@@ -0,0 +1,231 @@
+#ifndef LINE_INDEX_H_
+#define LINE_INDEX_H_
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The head of the file is indexed right away on the calling thread, so the
+// first screen can be shown before the rest of the index is ready.
+#define LINE_INDEX_HEAD_SIZE (64*1024)
+// Files smaller than this are not worth spinning up threads for
+#define LINE_INDEX_PARALLEL_MIN_SIZE (4*1024*1024)
+// Newline offsets inside of a slice are stored relative to the slice, so a
+// slice must fit into 32 bits. Slices are kept much smaller than that, so
+// the merged part of the index keeps growing while a big file is indexed.
+#define LINE_INDEX_SLICE_MAX_SIZE ((size_t) 32*1024*1024)
+#define LINE_INDEX_INIT_CAPACITY 1024
+
+typedef struct {
+    size_t begin;
+    size_t end;
+    uint32_t *newlines;
+    size_t count;
+    size_t capacity;
+    atomic_bool done;
+} Line_Index_Slice;
+
+typedef struct {
+    struct Line_Index *index;
+    size_t id;
+    pthread_t thread;
+    bool running;
+} Line_Index_Worker;
+
+// Offsets of every '\n' in `data`. Line `i` starts right after newline
+// `i - 1`. The tail of the data is split into slices that are scanned by
+// a worker per core, and the slices are merged into `newlines` in order
+// as they finish.
+typedef struct Line_Index {
+    const char *data;
+    size_t size;
+
+    size_t *newlines;
+    size_t count;
+    size_t capacity;
+    // Bytes [0..indexed) of the data are fully merged into `newlines`
+    size_t indexed;
+
+    Line_Index_Slice *slices;
+    size_t slices_count;
+    size_t slices_merged;
+    Line_Index_Worker *workers;
+    size_t workers_count;
+} Line_Index;
+
+void line_index_start(Line_Index *index, const char *data, size_t size);
+bool line_index_poll(Line_Index *index);
+void line_index_wait(Line_Index *index);
+bool line_index_done(const Line_Index *index);
+void line_index_free(Line_Index *index);
+
+#ifdef LINE_INDEX_IMPLEMENTATION
+
+static void line_index_push(Line_Index *index, size_t offset)
+{
+    if (index->count >= index->capacity) {
+        size_t new_capacity = index->capacity;
+        if (new_capacity == 0) {
+            new_capacity = LINE_INDEX_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+        index->newlines = realloc(index->newlines, new_capacity*sizeof(index->newlines[0]));
+        index->capacity = new_capacity;
+    }
+    index->newlines[index->count++] = offset;
+}
+
+static void line_index_slice_push(Line_Index_Slice *slice, uint32_t offset)
+{
+    if (slice->count >= slice->capacity) {
+        size_t new_capacity = slice->capacity;
+        if (new_capacity == 0) {
+            new_capacity = LINE_INDEX_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+        slice->newlines = realloc(slice->newlines, new_capacity*sizeof(slice->newlines[0]));
+        slice->capacity = new_capacity;
+    }
+    slice->newlines[slice->count++] = offset;
+}
+
+// glibc's memchr() is already vectorized, so it does the actual scanning
+static void line_index_scan_slice(const char *data, Line_Index_Slice *slice)
+{
+    const char *p = data + slice->begin;
+    const char *const end = data + slice->end;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        line_index_slice_push(slice, (uint32_t) (p - (data + slice->begin)));
+        p += 1;
+    }
+    atomic_store(&slice->done, true);
+}
+
+static void *line_index_worker(void *arg)
+{
+    Line_Index_Worker *worker = arg;
+    Line_Index *index = worker->index;
+    for (size_t i = worker->id; i < index->slices_count; i += index->workers_count) {
+        line_index_scan_slice(index->data, &index->slices[i]);
+    }
+    return NULL;
+}
+
+static size_t line_index_cores(void)
+{
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (size_t) cores : 1;
+}
+
+void line_index_start(Line_Index *index, const char *data, size_t size)
+{
+    memset(index, 0, sizeof(*index));
+    index->data = data;
+    index->size = size;
+
+    size_t head = size < LINE_INDEX_HEAD_SIZE ? size : LINE_INDEX_HEAD_SIZE;
+    if (size < LINE_INDEX_PARALLEL_MIN_SIZE) {
+        head = size;
+    }
+    const char *p = data;
+    while (p < data + head && (p = memchr(p, '\n', data + head - p)) != NULL) {
+        line_index_push(index, p - data);
+        p += 1;
+    }
+    index->indexed = head;
+    if (head == size) {
+        return;
+    }
+
+    const size_t rest = size - head;
+    index->workers_count = line_index_cores();
+    index->slices_count = index->workers_count;
+    while ((rest + index->slices_count - 1)/index->slices_count > LINE_INDEX_SLICE_MAX_SIZE) {
+        index->slices_count += index->workers_count;
+    }
+    index->slices = calloc(index->slices_count, sizeof(index->slices[0]));
+    const size_t slice_size = (rest + index->slices_count - 1)/index->slices_count;
+    for (size_t i = 0; i < index->slices_count; ++i) {
+        Line_Index_Slice *slice = &index->slices[i];
+        slice->begin = head + i*slice_size;
+        slice->end = slice->begin + slice_size;
+        if (slice->begin > size) {
+            slice->begin = size;
+        }
+        if (slice->end > size) {
+            slice->end = size;
+        }
+        atomic_init(&slice->done, false);
+    }
+
+    index->workers = calloc(index->workers_count, sizeof(index->workers[0]));
+    for (size_t i = 0; i < index->workers_count; ++i) {
+        Line_Index_Worker *worker = &index->workers[i];
+        worker->index = index;
+        worker->id = i;
+        worker->running = pthread_create(&worker->thread, NULL, line_index_worker, worker) == 0;
+        if (!worker->running) {
+            line_index_worker(worker);
+        }
+    }
+}
+
+bool line_index_done(const Line_Index *index)
+{
+    return index->indexed == index->size;
+}
+
+bool line_index_poll(Line_Index *index)
+{
+    while (index->slices_merged < index->slices_count) {
+        Line_Index_Slice *slice = &index->slices[index->slices_merged];
+        if (!atomic_load(&slice->done)) {
+            return false;
+        }
+        for (size_t i = 0; i < slice->count; ++i) {
+            line_index_push(index, slice->begin + slice->newlines[i]);
+        }
+        free(slice->newlines);
+        slice->newlines = NULL;
+        index->indexed = slice->end;
+        index->slices_merged += 1;
+    }
+
+    for (size_t i = 0; i < index->workers_count; ++i) {
+        if (index->workers[i].running) {
+            pthread_join(index->workers[i].thread, NULL);
+            index->workers[i].running = false;
+        }
+    }
+    return true;
+}
+
+void line_index_wait(Line_Index *index)
+{
+    for (size_t i = 0; i < index->workers_count; ++i) {
+        if (index->workers[i].running) {
+            pthread_join(index->workers[i].thread, NULL);
+            index->workers[i].running = false;
+        }
+    }
+    line_index_poll(index);
+}
+
+void line_index_free(Line_Index *index)
+{
+    line_index_wait(index);
+    free(index->newlines);
+    free(index->slices);
+    free(index->workers);
+    memset(index, 0, sizeof(*index));
+}
+
+#endif // LINE_INDEX_IMPLEMENTATION
+#endif // LINE_INDEX_H_
@@ -26,16 +26,27 @@
 #define GL_EXTRA_IMPLEMENTATION
 #include "gl_extra.h"
 
-#define EDITOR_IMPLEMENTATION
+// The editor core is compiled separately into libeditor.a
 #include "editor.h"
+#include "trace.h"
 
 #define GLYPH_IMPLEMENTATION
 #include "glyph.h"
 
+#define PROFILER_IMPLEMENTATION
+#include "profiler.h"
+
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 600
 #define FPS 600
 #define DELTA_TIME (1.0f / FPS)
+// How long the idle loop sleeps when no events arrive. Only a safety net,
+// since any event wakes it up right away.
+#define IDLE_TIMEOUT_MS 500
+// The camera is considered settled once it is this close to its target
+#define CAMERA_SETTLED_DISTANCE 0.5f
+// Where F4 writes the frames of the profiler to
+#define PROFILER_EXPORT_PATH "broadnick_profile.csv"
 
 #define FONT_WIDTH 128.f
 #define FONT_HEIGHT 64.f
@@ -97,6 +108,21 @@ void sdle_render_text_sized(SDL_Renderer *renderer, const Font *font,
   }
 }
 
+typedef struct {
+  SDL_Renderer *renderer;
+  const Font *font;
+  Vec2f pos;
+  Uint32 color;
+  float scale;
+} Sdle_Pen;
+
+void sdle_render_chunk(String_View chunk, void *data) {
+  Sdle_Pen *pen = data;
+  sdle_render_text_sized(pen->renderer, pen->font, chunk.data, chunk.count,
+                         pen->pos, pen->color, pen->scale);
+  pen->pos.x += chunk.count * FONT_CHAR_WIDTH * pen->scale;
+}
+
 void sdle_render_text(
     SDL_Renderer *renderer, 
     const Font *font,
@@ -109,11 +135,50 @@ void sdle_render_text(
 }
 
 #define FONT_SCALE 5.f
+#define SCROLLBAR_WIDTH 8
 
 Editor editor = {0};
 Vec2f camera_pos = {0};
 Vec2f camera_vel = {0};
 
+#define QUEUED_EVENTS_INIT_CAPACITY 64
+
+// Input that came in before the file was loaded far enough to take it.
+// Waiting for the load would freeze the window, so it is applied in order
+// once it can be.
+struct {
+  Trace_Event *items;
+  size_t count;
+  size_t capacity;
+} queued_events = {0};
+
+void queue_event(const Trace_Event *event) {
+  if (queued_events.count >= queued_events.capacity) {
+    queued_events.capacity = queued_events.capacity == 0
+                                 ? QUEUED_EVENTS_INIT_CAPACITY
+                                 : queued_events.capacity * 2;
+    queued_events.items =
+        realloc(queued_events.items,
+                queued_events.capacity * sizeof(queued_events.items[0]));
+  }
+  queued_events.items[queued_events.count++] = *event;
+}
+
+void apply_queued_events(const char *file_path) {
+  if (queued_events.count == 0) {
+    return;
+  }
+  size_t applied = 0;
+  while (applied < queued_events.count &&
+         trace_can_apply(&editor, &queued_events.items[applied])) {
+    trace_apply(&editor, &queued_events.items[applied], file_path);
+    applied += 1;
+  }
+  memmove(queued_events.items, queued_events.items + applied,
+          (queued_events.count - applied) * sizeof(queued_events.items[0]));
+  queued_events.count -= applied;
+}
+
 #define UNHEX(color)                                                           \
   ((color) >> (8 * 0)) & 0xFF, ((color) >> (8 * 1)) & 0xFF,                    \
       ((color) >> (8 * 2)) & 0xFF, ((color) >> (8 * 3)) & 0xFF
@@ -154,7 +219,236 @@ Vec2f window_size(SDL_Window *window) {
   return (Vec2f){.x = (float)window_width, .y = (float)window_height};
 }
 
-void camera_project_point(SDL_Window *window, Vec2f point) {
+typedef struct {
+  size_t row_begin;
+  size_t row_end;
+  size_t col_begin;
+  size_t col_end;
+} Viewport;
+
+// The rows and columns of the document that are at least partially
+// visible through the camera. Everything outside of it is not rendered.
+Viewport viewport_visible(SDL_Window *window) {
+  const Vec2f ws = window_size(window);
+  const float char_width = FONT_CHAR_WIDTH * FONT_SCALE;
+  const float line_height = FONT_CHAR_HEIGHT * FONT_SCALE;
+  const float top = camera_pos.y > 0 ? camera_pos.y : 0;
+  const float left = camera_pos.x > 0 ? camera_pos.x : 0;
+  const float bottom = camera_pos.y + ws.y;
+  const float right = camera_pos.x + ws.x;
+
+  Viewport viewport = {
+      .row_begin = (size_t)floorf(top / line_height),
+      .row_end = bottom > 0 ? (size_t)ceilf(bottom / line_height) : 0,
+      .col_begin = (size_t)floorf(left / char_width),
+      .col_end = right > 0 ? (size_t)ceilf(right / char_width) : 0,
+  };
+  const size_t line_count = editor_line_count(&editor);
+  if (viewport.row_end > line_count) {
+    viewport.row_end = line_count;
+  }
+  if (viewport.row_begin > viewport.row_end) {
+    viewport.row_begin = viewport.row_end;
+  }
+  if (viewport.col_begin > viewport.col_end) {
+    viewport.col_begin = viewport.col_end;
+  }
+  return viewport;
+}
+
+SDL_Rect scrollbar_rect(SDL_Window *window) {
+  const Vec2f ws = window_size(window);
+  const float line_height = FONT_CHAR_HEIGHT * FONT_SCALE;
+  const float document_height = editor_line_count(&editor) * line_height + ws.y;
+  float top = camera_pos.y;
+  if (top < 0) {
+    top = 0;
+  }
+  return (SDL_Rect){
+      .x = (int)ws.x - SCROLLBAR_WIDTH,
+      .y = (int)floorf(top / document_height * ws.y),
+      .w = SCROLLBAR_WIDTH,
+      .h = (int)ceilf(ws.y / document_height * ws.y),
+  };
+}
+
+void render_scrollbar(SDL_Renderer *renderer, SDL_Window *window) {
+  const SDL_Rect thumb = scrollbar_rect(window);
+  scc(SDL_SetRenderDrawColor(renderer, UNHEX(0x80808080)));
+  scc(SDL_RenderFillRect(renderer, &thumb));
+}
+
+// The profiler overlay is a small grid of cells laid out once per frame
+// and drawn by whichever renderer is active. The graph has a column per
+// frame, the latest one on the right, with the phases stacked bottom up.
+#define OVERLAY_SCALE 2.f
+#define OVERLAY_MARGIN 8.f
+#define OVERLAY_COLS 48
+#define OVERLAY_GRAPH_ROWS 8
+#define OVERLAY_ROWS (OVERLAY_GRAPH_ROWS + 4)
+
+typedef struct {
+  char ch;
+  Glyph_Color color;
+} Overlay_Cell;
+
+Profiler profiler = {0};
+bool overlay_visible = false;
+Overlay_Cell overlay[OVERLAY_ROWS][OVERLAY_COLS];
+
+static const Glyph_Color overlay_phase_colors[COUNT_PROFILER_PHASES] = {
+    [PROFILER_PHASE_EVENTS] = GLYPH_COLOR_YELLOW,
+    [PROFILER_PHASE_LAYOUT] = GLYPH_COLOR_GREEN,
+    [PROFILER_PHASE_GLYPHS] = GLYPH_COLOR_BLUE,
+    [PROFILER_PHASE_PRESENT] = GLYPH_COLOR_RED,
+};
+
+size_t overlay_print(size_t row, size_t col, Glyph_Color color,
+                     const char *text) {
+  for (; *text && col < OVERLAY_COLS; ++text, ++col) {
+    overlay[row][col] = (Overlay_Cell){.ch = *text, .color = color};
+  }
+  return col;
+}
+
+void overlay_layout(void) {
+  for (size_t row = 0; row < OVERLAY_ROWS; ++row) {
+    for (size_t col = 0; col < OVERLAY_COLS; ++col) {
+      overlay[row][col] = (Overlay_Cell){.ch = ' ', .color = GLYPH_COLOR_TEXT};
+    }
+  }
+
+  const size_t frames_count = profiler_frames_count(&profiler);
+  float total_sum = 0.0f;
+  float total_max = 0.0f;
+  float latency_max = -1.0f;
+  float latency_last = -1.0f;
+  for (size_t age = 0; age < frames_count; ++age) {
+    const Profiler_Frame *frame = profiler_frame(&profiler, age);
+    total_sum += frame->total_ms;
+    if (frame->total_ms > total_max) {
+      total_max = frame->total_ms;
+    }
+    if (frame->latency_ms > latency_max) {
+      latency_max = frame->latency_ms;
+    }
+    if (latency_last < 0.0f) {
+      latency_last = frame->latency_ms;
+    }
+  }
+
+  char line[OVERLAY_COLS + 1];
+  const Profiler_Frame *last = profiler_frame(&profiler, 0);
+  snprintf(line, sizeof(line), "frame %6.2fms avg %6.2f max %6.2f",
+           last ? last->total_ms : 0.0f,
+           frames_count ? total_sum / frames_count : 0.0f, total_max);
+  overlay_print(0, 0, GLYPH_COLOR_TEXT, line);
+  if (latency_max >= 0.0f) {
+    snprintf(line, sizeof(line), "input %6.2fms max %6.2f", latency_last,
+             latency_max);
+  } else {
+    snprintf(line, sizeof(line), "input -");
+  }
+  overlay_print(1, 0, GLYPH_COLOR_TEXT, line);
+  if (profiler.saves_count > 0) {
+    snprintf(line, sizeof(line), "save  %6.2fms fsync %6.2f",
+             profiler.last_save_write_ms, profiler.last_save_fsync_ms);
+  } else {
+    snprintf(line, sizeof(line), "save  -");
+  }
+  overlay_print(2, 0, GLYPH_COLOR_TEXT, line);
+  size_t col = 0;
+  for (Profiler_Phase phase = 0; phase < COUNT_PROFILER_PHASES; ++phase) {
+    col = overlay_print(3, col, overlay_phase_colors[phase],
+                        profiler_phase_names[phase]);
+    col += 1;
+  }
+
+  // The graph is scaled to the slowest frame on it
+  float scale_ms = 0.001f;
+  for (size_t age = 0; age < OVERLAY_COLS && age < frames_count; ++age) {
+    const Profiler_Frame *frame = profiler_frame(&profiler, age);
+    if (frame->total_ms > scale_ms) {
+      scale_ms = frame->total_ms;
+    }
+  }
+  for (size_t age = 0; age < OVERLAY_COLS && age < frames_count; ++age) {
+    const Profiler_Frame *frame = profiler_frame(&profiler, age);
+    const size_t col = OVERLAY_COLS - 1 - age;
+    for (size_t height = 0; height < OVERLAY_GRAPH_ROWS; ++height) {
+      const float ms = (height + 0.5f) * scale_ms / OVERLAY_GRAPH_ROWS;
+      float top_ms = 0.0f;
+      for (Profiler_Phase phase = 0; phase < COUNT_PROFILER_PHASES; ++phase) {
+        top_ms += frame->phases_ms[phase];
+        if (ms < top_ms) {
+          overlay[OVERLAY_ROWS - 1 - height][col] = (Overlay_Cell){
+              .ch = GLYPH_SOLID,
+              .color = overlay_phase_colors[phase],
+          };
+          break;
+        }
+      }
+    }
+  }
+}
+
+Uint32 overlay_sdl_color(Glyph_Color color) {
+  const Vec4f c = glyph_palette[color];
+  return (Uint32)(c.x * 255.0f) << (8 * 0) |
+         (Uint32)(c.y * 255.0f) << (8 * 1) |
+         (Uint32)(c.z * 255.0f) << (8 * 2) | (Uint32)(c.t * 255.0f) << (8 * 3);
+}
+
+void sdl_render_overlay(SDL_Renderer *renderer, const Font *font) {
+  const float cell_width = FONT_CHAR_WIDTH * OVERLAY_SCALE;
+  const float cell_height = FONT_CHAR_HEIGHT * OVERLAY_SCALE;
+  scc(SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND));
+  for (size_t row = 0; row < OVERLAY_ROWS; ++row) {
+    for (size_t col = 0; col < OVERLAY_COLS; ++col) {
+      const Overlay_Cell *cell = &overlay[row][col];
+      const Vec2f pos = {
+          .x = OVERLAY_MARGIN + col * cell_width,
+          .y = OVERLAY_MARGIN + row * cell_height,
+      };
+      const SDL_Rect rect = {
+          .x = (int)floorf(pos.x),
+          .y = (int)floorf(pos.y),
+          .w = (int)ceilf(cell_width),
+          .h = (int)ceilf(cell_height),
+      };
+      const Glyph_Color background =
+          cell->ch == GLYPH_SOLID ? cell->color : GLYPH_COLOR_PANEL;
+      scc(SDL_SetRenderDrawColor(renderer,
+                                 UNHEX(overlay_sdl_color(background))));
+      scc(SDL_RenderFillRect(renderer, &rect));
+      if (cell->ch != ' ' && cell->ch != GLYPH_SOLID) {
+        set_texture_color(font->spritesheet, overlay_sdl_color(cell->color));
+        sdle_render_char(renderer, font, cell->ch, pos, OVERLAY_SCALE);
+      }
+    }
+  }
+  scc(SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE));
+}
+
+// `status` is a string literal, so it can be compared by address
+void update_window_title(SDL_Window *window, const char *file_path,
+                         const char *status) {
+  static size_t shown_line_count = SIZE_MAX;
+  static char shown_status[64] = "";
+  const size_t line_count = editor_line_count(&editor);
+  if (line_count == shown_line_count && strcmp(status, shown_status) == 0) {
+    return;
+  }
+  char title[256];
+  snprintf(title, sizeof(title), "broadnic - %s - %zu lines%s",
+           file_path ? file_path : "[scratch]", line_count, status);
+  SDL_SetWindowTitle(window, title);
+  shown_line_count = line_count;
+  snprintf(shown_status, sizeof(shown_status), "%s", status);
+}
+
+// Returns whether the camera is still on its way to the point
+bool camera_project_point(SDL_Window *window, Vec2f point) {
   Vec2f cp = {0};
   Vec2f ws = window_size(window);
   vec2f_add(&cp, camera_pos);
@@ -165,11 +459,10 @@ void camera_project_point(SDL_Window *window, Vec2f point) {
   vec2f_mul(&camera_vel, (Vec2f){.x = DELTA_TIME, .y = DELTA_TIME});
   vec2f_mul(&camera_vel, (Vec2f){.x = 2, .y = 2});
   vec2f_add(&camera_pos, camera_vel);
+  return fabsf(cp.x) > CAMERA_SETTLED_DISTANCE ||
+         fabsf(cp.y) > CAMERA_SETTLED_DISTANCE;
 }
 
-//#define OPENGL_RENDERER
-
-
 void MessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
                      GLsizei length, const GLchar *message,
                      const void *userParam) {
@@ -181,194 +474,495 @@ void MessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
           message);
 }
 
-#ifdef OPENGL_RENDERER
-int main(int argc, char **argv) {
-    (void)argc;
-    (void)argv;
-    scc(SDL_Init(SDL_INIT_VIDEO));
-
-    SDL_Window *window =
-        scp(SDL_CreateWindow("broadnic", 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT,
-                             SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE));
-
-    {
-        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
-        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
-                            SDL_GL_CONTEXT_PROFILE_CORE);
-        int major, minor;
-        SDL_GL_GetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, &major);
-        SDL_GL_GetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, &minor);
-        printf("GL version: %d.%d\n", major, minor);
-    }
+typedef enum {
+  RENDERER_OPENGL = 0,
+  RENDERER_SDL,
+} Renderer_Backend;
 
-    scp(SDL_GL_CreateContext(window));
+typedef struct {
+  SDL_GLContext context;
+  GLint tint_uniform;
+  GLint resolution_uniform;
+  GLint origin_uniform;
+  GLint cell_size_uniform;
+} Gl_Renderer;
 
-    if (GLEW_OK != glewInit()) {
-        fprintf(stderr, "[ERROR] Could not initialize GLEW: %s\n", strerror(errno));
-        exit(1);
-    }
+Gl_Renderer gl_renderer = {0};
 
-    if (!GLEW_ARB_draw_instanced) {
-        fprintf(stderr, "[ERROR] `ARB_draw_instanced` is not supported! Program may not work properly.\n");
-        exit(1);
-    }
+// Sets up the instanced glyph pipeline on the window. Returns false if
+// anything is missing, in which case the caller falls back to the SDL
+// renderer.
+bool gl_renderer_init(SDL_Window *window) {
+  gl_renderer.context = SDL_GL_CreateContext(window);
+  if (gl_renderer.context == NULL) {
+    fprintf(stderr, "[ERROR] Could not create GL context: %s\n",
+            SDL_GetError());
+    return false;
+  }
 
-    if (!GLEW_ARB_instanced_arrays) {
-        fprintf(stderr, "[ERROR] `ARB_instanced_arrays` is not supported! Program may not work properly.\n");
-        exit(1);
-    }
+  {
+    int major, minor;
+    SDL_GL_GetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, &major);
+    SDL_GL_GetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, &minor);
+    printf("GL version: %d.%d\n", major, minor);
+  }
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  if (GLEW_OK != glewInit()) {
+    fprintf(stderr, "[ERROR] Could not initialize GLEW\n");
+    return false;
+  }
 
-    if (GLEW_ARB_debug_output) {
-        glEnable(GL_DEBUG_OUTPUT);
-        glDebugMessageCallback(MessageCallback, 0);
-    } else {
-        fprintf(stderr, "[WARNING] `GLEW_ARB_debug_output` is not available");
-    }
+  if (!GLEW_ARB_draw_instanced) {
+    fprintf(stderr, "[ERROR] `ARB_draw_instanced` is not supported!\n");
+    return false;
+  }
 
-    GLint time_uniform;
-    GLint resolution_uniform;
-    // Shader initialization
-    {
-        GLuint vert_shader = 0;
-        if (!compile_shader_file("./shaders/font.vert", GL_VERTEX_SHADER,
-                                 &vert_shader)) {
-            exit(1);
-        }
-        GLuint frag_shader = 0;
-        if (!compile_shader_file("./shaders/font.frag", GL_FRAGMENT_SHADER,
-                                 &frag_shader)) {
-            exit(1);
-        }
-        GLuint program = 0;
-        if (!link_program(vert_shader, frag_shader, &program)) {
-            exit(1);
-        }
-        glUseProgram(program);
-        time_uniform = glGetUniformLocation(program, "time");
-        resolution_uniform = glGetUniformLocation(program, "resolution");
-        glUniform2f(resolution_uniform, SCREEN_WIDTH, SCREEN_HEIGHT);
+  if (!GLEW_ARB_instanced_arrays) {
+    fprintf(stderr, "[ERROR] `ARB_instanced_arrays` is not supported!\n");
+    return false;
+  }
+
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  if (GLEW_ARB_debug_output) {
+    glEnable(GL_DEBUG_OUTPUT);
+    glDebugMessageCallback(MessageCallback, 0);
+  } else {
+    fprintf(stderr, "[WARNING] `GLEW_ARB_debug_output` is not available\n");
+  }
+
+  // Shader initialization
+  {
+    GLuint vert_shader = 0;
+    if (!compile_shader_file("./shaders/font.vert", GL_VERTEX_SHADER,
+                             &vert_shader)) {
+      return false;
+    }
+    GLuint frag_shader = 0;
+    if (!compile_shader_file("./shaders/font.frag", GL_FRAGMENT_SHADER,
+                             &frag_shader)) {
+      return false;
     }
+    GLuint program = 0;
+    if (!link_program(vert_shader, frag_shader, &program)) {
+      return false;
+    }
+    glUseProgram(program);
+    gl_renderer.tint_uniform = glGetUniformLocation(program, "tint");
+    gl_renderer.resolution_uniform =
+        glGetUniformLocation(program, "resolution");
+    gl_renderer.origin_uniform = glGetUniformLocation(program, "origin");
+    gl_renderer.cell_size_uniform = glGetUniformLocation(program, "cell_size");
+    glUniform4fv(glGetUniformLocation(program, "palette"), COUNT_GLYPH_COLORS,
+                 (const GLfloat *)glyph_palette);
+  }
 
-    // Font Texture initialization
-    {
-        const char *file_path = "charmap-oldschool_white.png";
-        int width, height, n;
-        unsigned char *pixels =
-            stbi_load(file_path, &width, &height, &n, STBI_rgb_alpha);
-        if (pixels == NULL) {
-            fprintf(stderr, "ERROR: could not load %s: %s\n", file_path,
-                    stbi_failure_reason());
-            exit(1);
-        }
-        glActiveTexture(GL_TEXTURE0);
-        GLuint font_texture = 0;
-        glGenTextures(1, &font_texture);
-        glBindTexture(GL_TEXTURE_2D, font_texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
-                     GL_UNSIGNED_BYTE, pixels);
+  // Font Texture initialization
+  {
+    const char *file_path = "charmap-oldschool_white.png";
+    int width, height, n;
+    unsigned char *pixels =
+        stbi_load(file_path, &width, &height, &n, STBI_rgb_alpha);
+    if (pixels == NULL) {
+      fprintf(stderr, "ERROR: could not load %s: %s\n", file_path,
+              stbi_failure_reason());
+      return false;
     }
+    glActiveTexture(GL_TEXTURE0);
+    GLuint font_texture = 0;
+    glGenTextures(1, &font_texture);
+    glBindTexture(GL_TEXTURE_2D, font_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, pixels);
+    stbi_image_free(pixels);
+  }
 
-    // Buffers initialization
-    {
-        GLuint vao = 0;
-        glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
-
-        GLuint vbo = 0;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(glyph_buffer), glyph_buffer, GL_DYNAMIC_DRAW);
-
-        for (Glyph_Attr attr=0; attr < COUNT_GLYPH_ATTRS; ++attr) {
-            glEnableVertexAttribArray(attr);
-            glVertexAttribPointer(
-                attr,
-                glyph_attr_defs[attr].comps,
-                GL_FLOAT,
-                GL_FALSE,
-                sizeof(Glyph),
-                (void*) glyph_attr_defs[attr].offset
-            );
-            glVertexAttribDivisor(attr, 1);
-        }
+  glyph_buffer_init();
+
+  return true;
+}
+
+void gl_renderer_free(void) {
+  if (gl_renderer.context != NULL) {
+    SDL_GL_DeleteContext(gl_renderer.context);
+  }
+  memset(&gl_renderer, 0, sizeof(gl_renderer));
+}
+
+typedef struct {
+  int col;
+  int row;
+  Glyph_Color color;
+} Ogl_Pen;
+
+void ogl_render_chunk(String_View chunk, void *data) {
+  Ogl_Pen *pen = data;
+  ogl_render_text(chunk.data, chunk.count, pen->col, pen->row, pen->color);
+  pen->col += chunk.count;
+}
+
+// Drawn as a second batch with its own origin and cell size on top of
+// the document
+void gl_render_overlay(void) {
+  glUniform2f(gl_renderer.origin_uniform, OVERLAY_MARGIN, OVERLAY_MARGIN);
+  glUniform2f(gl_renderer.cell_size_uniform, FONT_CHAR_WIDTH * OVERLAY_SCALE,
+              FONT_CHAR_HEIGHT * OVERLAY_SCALE);
+  glUniform4f(gl_renderer.tint_uniform, 1.0f, 1.0f, 1.0f, 1.0f);
+  for (size_t row = 0; row < OVERLAY_ROWS; ++row) {
+    for (size_t col = 0; col < OVERLAY_COLS; ++col) {
+      const Overlay_Cell *cell = &overlay[row][col];
+      if (cell->ch != GLYPH_SOLID) {
+        glyph_buffer_push((Glyph){
+            .col = col,
+            .row = row,
+            .ch = GLYPH_SOLID,
+            .color = GLYPH_COLOR_PANEL,
+        });
+      }
+      if (cell->ch != ' ') {
+        glyph_buffer_push((Glyph){
+            .col = col,
+            .row = row,
+            .ch = (uint8_t)cell->ch,
+            .color = cell->color,
+        });
+      }
     }
+  }
+  glyph_buffer_flush();
+}
 
-    const char *text = "Hello, World";
-    Vec2f text_pos = {.x=0,.y=0};
-    float text_scale = 5.f;
-    Vec4f text_color = {.x=0.0f,.y=1.0f,.z=0.0f,.t=1.0f};
-
-    ogl_render_text(text, strlen(text), text_pos, text_scale, text_color);
-    glyph_buffer_sync();
-
-    bool quit = false;
-    while (!quit) {
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_QUIT: {
-                    quit = true;
-                } break;
-                case SDL_KEYDOWN: {
-                    switch (event.key.keysym.sym) {
-                        case SDLK_ESCAPE: {
-                            quit = true;
-                        } break;
-                    }
-                } break;
-            }
-        }
+// The whole visible part of the document, the cursor included, is pushed
+// into the glyph buffer and drawn with a single instanced draw call.
+void gl_render_frame(SDL_Window *window) {
+  const Vec2f ws = window_size(window);
+  int drawable_width, drawable_height;
+  SDL_GL_GetDrawableSize(window, &drawable_width, &drawable_height);
+  glViewport(0, 0, drawable_width, drawable_height);
+  glUniform2f(gl_renderer.resolution_uniform, ws.x, ws.y);
+  // The tint only depends on time, so it is computed once per frame
+  // instead of for every pixel
+  const float time = (float)SDL_GetTicks() / 1000.0f;
+  glUniform4f(gl_renderer.tint_uniform, (sinf(time) + 1.0f) / 2.0f,
+              (cosf(time) + 1.0f) / 2.0f, (sinf(time) + 1.0f) / 2.0f, 1.0f);
+  glUniform2f(gl_renderer.cell_size_uniform, FONT_CHAR_WIDTH * FONT_SCALE,
+              FONT_CHAR_HEIGHT * FONT_SCALE);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
+  glClearColor(8.0f / 255.0f, 8.0f / 255.0f, 8.0f / 255.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
 
-        glUniform1f(time_uniform, (float)SDL_GetTicks()/1000.0f);
+  // Glyph cells are relative to the top left visible cell, so they stay
+  // small no matter how far into the document the camera is
+  const Viewport viewport = viewport_visible(window);
+  glUniform2f(gl_renderer.origin_uniform,
+              viewport.col_begin * FONT_CHAR_WIDTH * FONT_SCALE - camera_pos.x,
+              viewport.row_begin * FONT_CHAR_HEIGHT * FONT_SCALE -
+                  camera_pos.y);
 
-        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, glyph_buffer_count);
+  glyph_buffer_clear();
+  for (size_t row = viewport.row_begin; row < viewport.row_end; ++row) {
+    Ogl_Pen pen = {
+        .col = 0,
+        .row = row - viewport.row_begin,
+        .color = GLYPH_COLOR_TEXT,
+    };
+    editor_visit_line_cols(&editor, row, viewport.col_begin,
+                           viewport.col_end - viewport.col_begin,
+                           ogl_render_chunk, &pen);
+  }
 
-        SDL_GL_SwapWindow(window);
+  const long long cursor_col =
+      (long long)editor.cursor_col - (long long)viewport.col_begin;
+  const long long cursor_row =
+      (long long)editor.cursor_row - (long long)viewport.row_begin;
+  if (INT16_MIN <= cursor_col && cursor_col <= INT16_MAX &&
+      INT16_MIN <= cursor_row && cursor_row <= INT16_MAX) {
+    glyph_buffer_push((Glyph){
+        .col = cursor_col,
+        .row = cursor_row,
+        .ch = GLYPH_SOLID,
+        .color = GLYPH_COLOR_CURSOR,
+    });
+    const char *c = editor_char_under_cursor(&editor);
+    if (c) {
+      ogl_render_text(c, 1, cursor_col, cursor_row, GLYPH_COLOR_CURSOR_TEXT);
     }
+  }
+  profiler_mark(&profiler, PROFILER_PHASE_LAYOUT);
+  glyph_buffer_flush();
+
+  // The scrollbar is not aligned to the glyph grid, so it is simply
+  // cleared into place
+  const SDL_Rect thumb = scrollbar_rect(window);
+  const float sx = drawable_width / ws.x;
+  const float sy = drawable_height / ws.y;
+  glEnable(GL_SCISSOR_TEST);
+  glScissor((GLint)(thumb.x * sx),
+            (GLint)(drawable_height - (thumb.y + thumb.h) * sy),
+            (GLsizei)ceilf(thumb.w * sx), (GLsizei)ceilf(thumb.h * sy));
+  glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glDisable(GL_SCISSOR_TEST);
+
+  if (overlay_visible) {
+    gl_render_overlay();
+  }
+  profiler_mark(&profiler, PROFILER_PHASE_GLYPHS);
+
+  SDL_GL_SwapWindow(window);
+  profiler_mark(&profiler, PROFILER_PHASE_PRESENT);
+}
+
+void sdl_render_frame(SDL_Renderer *renderer, const Font *font,
+                      SDL_Window *window) {
+  scc(SDL_SetRenderDrawColor(renderer, 8, 8, 8, 255));
+  scc(SDL_RenderClear(renderer));
+
+  const Viewport viewport = viewport_visible(window);
+  for (size_t row = viewport.row_begin; row < viewport.row_end; ++row) {
+    Sdle_Pen pen = {
+        .renderer = renderer,
+        .font = font,
+        .color = 0xFFFFFFFF,
+        .scale = FONT_SCALE,
+    };
+    vec2f_make(&pen.pos, viewport.col_begin * FONT_CHAR_WIDTH * FONT_SCALE,
+               row * FONT_CHAR_HEIGHT * FONT_SCALE);
+    vec2f_sub(&pen.pos, camera_pos);
+    editor_visit_line_cols(&editor, row, viewport.col_begin,
+                           viewport.col_end - viewport.col_begin,
+                           sdle_render_chunk, &pen);
+  }
+
+  render_cursor(renderer, font);
+  render_scrollbar(renderer, window);
+  if (overlay_visible) {
+    sdl_render_overlay(renderer, font);
+  }
+  profiler_mark(&profiler, PROFILER_PHASE_GLYPHS);
 
-    return 0;
+  SDL_RenderPresent(renderer);
+  profiler_mark(&profiler, PROFILER_PHASE_PRESENT);
 }
-#else
+
+// Only the events that change the editor are traced
+bool trace_event_from_sdl(const SDL_Event *evt, Trace_Event *event) {
+  switch (evt->type) {
+  case SDL_KEYDOWN: {
+    event->kind = TRACE_EVENT_KEY;
+    switch (evt->key.keysym.sym) {
+    case SDLK_TAB:
+      event->key = TRACE_KEY_TAB;
+      return true;
+    case SDLK_BACKSPACE:
+      event->key = TRACE_KEY_BACKSPACE;
+      return true;
+    case SDLK_F2:
+      event->key = TRACE_KEY_SAVE;
+      return true;
+    case SDLK_DELETE:
+      event->key = TRACE_KEY_DELETE;
+      return true;
+    case SDLK_UP:
+      event->key = TRACE_KEY_UP;
+      return true;
+    case SDLK_DOWN:
+      event->key = TRACE_KEY_DOWN;
+      return true;
+    case SDLK_LEFT:
+      event->key = TRACE_KEY_LEFT;
+      return true;
+    case SDLK_RIGHT:
+      event->key = TRACE_KEY_RIGHT;
+      return true;
+    case SDLK_RETURN:
+      event->key = TRACE_KEY_RETURN;
+      return true;
+    case SDLK_z:
+      if (evt->key.keysym.mod & KMOD_CTRL) {
+        event->key = (evt->key.keysym.mod & KMOD_SHIFT) ? TRACE_KEY_REDO
+                                                        : TRACE_KEY_UNDO;
+        return true;
+      }
+      break;
+    case SDLK_y:
+      if (evt->key.keysym.mod & KMOD_CTRL) {
+        event->key = TRACE_KEY_REDO;
+        return true;
+      }
+      break;
+    }
+  } break;
+  case SDL_TEXTINPUT: {
+    event->kind = TRACE_EVENT_TEXT;
+    strncpy(event->text, evt->text.text, TRACE_TEXT_CAPACITY - 1);
+    return true;
+  } break;
+  }
+  return false;
+}
+
 int main(int argc, char **argv) {
   argv_shift(&argc, &argv);
   char *loaded_file_path = NULL;
+  char *trace_path = NULL;
+  Renderer_Backend renderer_backend = RENDERER_OPENGL;
 
-  if (argc > 0) {
-    loaded_file_path = argv_shift(&argc, &argv);
-    printf("`%s` loaded\n", loaded_file_path);
+  while (argc > 0) {
+    char *arg = argv_shift(&argc, &argv);
+    if (strcmp(arg, "--piece-table") == 0) {
+      editor.backend = EDITOR_BACKEND_PIECE_TABLE;
+    } else if (strcmp(arg, "--rope") == 0) {
+      editor.backend = EDITOR_BACKEND_ROPE;
+    } else if (strcmp(arg, "--sdl") == 0) {
+      renderer_backend = RENDERER_SDL;
+    } else if (strcmp(arg, "--spans") == 0) {
+      if (argc == 0) {
+        fprintf(stderr, "ERROR: no output path is provided for --spans\n");
+        exit(1);
+      }
+      if (!spans_start(argv_shift(&argc, &argv))) {
+        exit(1);
+      }
+    } else if (strcmp(arg, "--fsync") == 0) {
+      if (argc == 0) {
+        fprintf(stderr, "ERROR: no policy is provided for --fsync\n");
+        exit(1);
+      }
+      const char *policy = argv_shift(&argc, &argv);
+      Save_Fsync fsync_policy = 0;
+      while (fsync_policy < COUNT_SAVE_FSYNCS &&
+             strcmp(policy, save_fsync_names[fsync_policy]) != 0) {
+        fsync_policy += 1;
+      }
+      if (fsync_policy == COUNT_SAVE_FSYNCS) {
+        fprintf(stderr, "ERROR: --fsync expects none, data or full, got %s\n",
+                policy);
+        exit(1);
+      }
+      editor.save_fsync = fsync_policy;
+    } else if (strcmp(arg, "--save-in-place") == 0) {
+      editor.save_in_place = true;
+    } else if (strcmp(arg, "--undo-limit") == 0) {
+      if (argc == 0) {
+        fprintf(stderr, "ERROR: no size in MB is provided for --undo-limit\n");
+        exit(1);
+      }
+      const char *limit = argv_shift(&argc, &argv);
+      char *end = NULL;
+      const unsigned long mb = strtoul(limit, &end, 10);
+      if (end == limit || *end != '\0' || mb == 0) {
+        fprintf(stderr, "ERROR: --undo-limit expects a size in MB, got %s\n",
+                limit);
+        exit(1);
+      }
+      editor.undo.max_size = (size_t)mb * 1024 * 1024;
+    } else if (strcmp(arg, "--record") == 0) {
+      if (argc == 0) {
+        fprintf(stderr, "ERROR: no trace path is provided for --record\n");
+        exit(1);
+      }
+      trace_path = argv_shift(&argc, &argv);
+    } else {
+      loaded_file_path = arg;
+      printf("`%s` loaded\n", loaded_file_path);
+    }
+  }
+
+  Trace_Writer trace_writer = {0};
+  if (trace_path &&
+      !trace_writer_open(&trace_writer, trace_path, editor.backend,
+                         loaded_file_path)) {
+    exit(1);
   }
 
+  scc(SDL_Init(SDL_INIT_VIDEO));
+
+  Uint32 window_flags = SDL_WINDOW_RESIZABLE;
+  if (renderer_backend == RENDERER_OPENGL) {
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
+                        SDL_GL_CONTEXT_PROFILE_CORE);
+    window_flags |= SDL_WINDOW_OPENGL;
+  }
+  SDL_Window *window = scp(SDL_CreateWindow(
+      "broadnic", 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, window_flags));
+
+  if (renderer_backend == RENDERER_OPENGL && !gl_renderer_init(window)) {
+    fprintf(stderr, "[WARNING] Falling back to the SDL renderer\n");
+    gl_renderer_free();
+    renderer_backend = RENDERER_SDL;
+  }
+
+  SDL_Renderer *renderer = NULL;
+  Font font = {0};
+  if (renderer_backend == RENDERER_SDL) {
+    renderer =
+        scp(SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED));
+    font = font_load_from_file(renderer, "./charmap-oldschool_white.png");
+  }
+
+  // The window is up first. The file comes in while the frames are drawn,
+  // so the part that is already there can be looked at. The journal is
+  // replayed over it once all of it is there.
   if (loaded_file_path) {
     FILE *file = fopen(loaded_file_path, "r");
     if (file != NULL) {
       editor_load_from_file(&editor, file);
       fclose(file);
     }
+    editor_journal_open(&editor, loaded_file_path);
   }
 
-  scc(SDL_Init(SDL_INIT_VIDEO));
-
-  SDL_Window *window = scp(SDL_CreateWindow(
-      "broadnic", 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_RESIZABLE));
-  SDL_Renderer *renderer =
-      SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-
-  Font font = font_load_from_file(renderer, "./charmap-oldschool_white.png");
-
   bool quit = false;
+  bool animating = true;
+  bool save_failed = false;
   while (!quit) {
-    const Uint32 start = SDL_GetTicks();
+    // Nothing is moving and nothing is loading, so there is nothing to
+    // redraw until an event arrives. Passing NULL leaves the event in the
+    // queue for the loop below.
+    if (!animating) {
+      SDL_WaitEventTimeout(NULL, IDLE_TIMEOUT_MS);
+    }
+    SPAN("frame");
+
+    profiler_begin_frame(&profiler);
+    const bool loading = editor_load_poll(&editor);
+    const size_t recovered = editor_journal_poll(&editor);
+    if (recovered > 0) {
+      printf("Recovered %zu edits of `%s`\n", recovered, loaded_file_path);
+    }
+    int save_error = 0;
+    const Editor_Save_Status save = editor_save_poll(&editor, &save_error);
+    if (save == EDITOR_SAVE_DONE) {
+      save_failed = false;
+      profiler_save(&profiler, editor.save.timings.write_ms,
+                    editor.save.timings.fsync_ms);
+    } else if (save == EDITOR_SAVE_FAILED) {
+      fprintf(stderr, "ERROR: could not save %s: %s\n", loaded_file_path,
+              strerror(save_error));
+      save_failed = true;
+    }
+    const bool saving = save == EDITOR_SAVE_RUNNING;
+    char loading_status[32];
+    const float progress = editor_load_progress(&editor);
+    if (progress < 0.0f) {
+      snprintf(loading_status, sizeof(loading_status), " (loading...)");
+    } else {
+      snprintf(loading_status, sizeof(loading_status), " (loading %d%%)",
+               (int)(progress * 100.0f));
+    }
+    update_window_title(window, loaded_file_path,
+                        loading       ? loading_status
+                        : saving      ? " (saving...)"
+                        : save_failed ? " (save failed)"
+                                      : "");
     SDL_Event evt = {0};
     while (SDL_PollEvent(&evt)) {
       switch (evt.type) {
@@ -377,86 +971,71 @@ int main(int argc, char **argv) {
       } break;
       case SDL_KEYDOWN: {
         switch (evt.key.keysym.sym) {
-        case SDLK_TAB: {
-          editor_insert_text_before_cursor(&editor, "  ");
-        } break;
-        case SDLK_BACKSPACE: {
-          editor_backspace(&editor);
-        } break;
-        case SDLK_F2: {
-          if (loaded_file_path) {
-            editor_save_to_file(&editor, loaded_file_path);
-          }
-        } break;
-        case SDLK_DELETE: {
-          editor_delete(&editor);
-        } break;
-        case SDLK_UP: {
-          if (editor.cursor_row > 0) {
-            editor.cursor_row -= 1;
-          }
-        } break;
-        case SDLK_DOWN: {
-          if (editor.cursor_row < editor.size) {
-            editor.cursor_row += 1;
-          }
+        case SDLK_ESCAPE: {
+          quit = true;
         } break;
-        case SDLK_LEFT: {
-          if (editor.cursor_col > 0) {
-            editor.cursor_col -= 1;
-          }
+        case SDLK_F3: {
+          overlay_visible = !overlay_visible;
         } break;
-        case SDLK_RIGHT: {
-          if (editor.cursor_col < 80) {
-            editor.cursor_col += 1;
+        case SDLK_F4: {
+          if (profiler_export(&profiler, PROFILER_EXPORT_PATH)) {
+            printf("Profile saved to %s\n", PROFILER_EXPORT_PATH);
           }
         } break;
-        case SDLK_RETURN: {
-          editor_insert_new_line(&editor);
-        } break;
-        case SDLK_ESCAPE: {
-          quit = true;
-        } break;
         }
       } break;
-      case SDL_TEXTINPUT: {
-        editor_insert_text_before_cursor(&editor, evt.text.text);
-      } break;
       }
-    }
-
-    scc(SDL_SetRenderDrawColor(renderer, 8, 8, 8, 255));
-    scc(SDL_RenderClear(renderer));
 
-    for (size_t row = 0; row < editor.size; ++row) {
-      const Line *line = editor.lines + row;
-      Vec2f line_pos = {0};
-      vec2f_make(&line_pos, 0, row * FONT_CHAR_HEIGHT * FONT_SCALE);
-      vec2f_sub(&line_pos, camera_pos);
-      sdle_render_text_sized(renderer, &font, line->es, line->size, line_pos,
-                        0xFFFFFFFF, FONT_SCALE);
+      Trace_Event event = {0};
+      if (trace_event_from_sdl(&evt, &event)) {
+        profiler_input(&profiler, evt.common.timestamp);
+        if (trace_writer.file) {
+          trace_write(&trace_writer, &event);
+        }
+        queue_event(&event);
+      }
     }
+    apply_queued_events(loaded_file_path);
+    profiler_mark(&profiler, PROFILER_PHASE_EVENTS);
 
     const Vec2f cursor_pos = {
         .x = (int)floorf(editor.cursor_col * FONT_CHAR_WIDTH * FONT_SCALE),
         .y = (int)floorf(editor.cursor_row * FONT_CHAR_HEIGHT * FONT_SCALE),
     };
-    camera_project_point(window, cursor_pos);
+    animating = camera_project_point(window, cursor_pos) || loading || saving;
+    if (overlay_visible) {
+      overlay_layout();
+    }
+    profiler_mark(&profiler, PROFILER_PHASE_LAYOUT);
 
-    render_cursor(renderer, &font);
+    switch (renderer_backend) {
+    case RENDERER_OPENGL: {
+      gl_render_frame(window);
+    } break;
+    case RENDERER_SDL: {
+      sdl_render_frame(renderer, &font, window);
+    } break;
+    default:
+      assert(0 && "unreachable");
+    }
 
-    SDL_RenderPresent(renderer);
-    const Uint32 duration = SDL_GetTicks() - start;
-    const Uint32 delta_time_ms = 1000 / FPS;
-    if (duration < delta_time_ms) {
-      SDL_Delay(delta_time_ms - duration);
+    const float duration_ms = profiler_end_frame(&profiler);
+    const float delta_time_ms = 1000.0f / FPS;
+    if (duration_ms < delta_time_ms) {
+      SDL_Delay((Uint32)(delta_time_ms - duration_ms));
     }
   }
+  // Quitting right after F2 must not leave a half written file behind
+  int save_error = 0;
+  if (editor_save_wait(&editor, &save_error) == EDITOR_SAVE_FAILED) {
+    fprintf(stderr, "ERROR: could not save %s: %s\n", loaded_file_path,
+            strerror(save_error));
+  }
+  editor_journal_close(&editor);
+  trace_writer_close(&trace_writer);
+  spans_stop();
+  gl_renderer_free();
   SDL_DestroyWindow(window);
   SDL_Quit();
   return 0;
 }
-#endif // OPENGL_RENDERER
-
-#define SV_IMPLEMENTATION
-#include "sv.h"
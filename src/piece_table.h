@@ -0,0 +1,386 @@
+#ifndef PIECE_TABLE_H_
+#define PIECE_TABLE_H_
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sv.h"
+
+typedef enum {
+    PIECE_ORIGINAL = 0,
+    PIECE_ADD,
+    COUNT_PIECE_SOURCES,
+} Piece_Source;
+
+typedef struct {
+    Piece_Source source;
+    size_t start;
+    size_t size;
+    size_t newlines;
+    // Running totals over the pieces up to and including this one, so that
+    // pieces are found by offset or by row with a binary search
+    size_t end;
+    size_t newlines_end;
+} Piece;
+
+// A buffer the pieces point into. The original buffer is never modified
+// and the add buffer is only ever appended to. Offsets of every '\n' are
+// kept so that newlines inside of a piece can be counted and located with
+// a binary search instead of scanning the text.
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t *newlines;
+    size_t newlines_count;
+    size_t newlines_capacity;
+} Piece_Buffer;
+
+#define PIECE_TABLE_INIT_CAPACITY 128
+
+typedef struct {
+    Piece_Buffer buffers[COUNT_PIECE_SOURCES];
+    Piece *pieces;
+    size_t pieces_count;
+    size_t pieces_capacity;
+    size_t size;
+    size_t newlines;
+} Piece_Table;
+
+typedef void (*Piece_Visitor)(String_View chunk, void *data);
+
+void pt_load(Piece_Table *pt, char *data, size_t size, size_t *newlines, size_t newlines_count);
+void pt_free(Piece_Table *pt);
+
+size_t pt_line_count(const Piece_Table *pt);
+size_t pt_line_offset(const Piece_Table *pt, size_t row);
+size_t pt_line_size(const Piece_Table *pt, size_t row);
+const char *pt_char_at(const Piece_Table *pt, size_t offset);
+
+void pt_insert(Piece_Table *pt, size_t offset, const char *text, size_t text_size);
+void pt_delete(Piece_Table *pt, size_t offset, size_t count);
+void pt_visit(const Piece_Table *pt, size_t offset, size_t count, Piece_Visitor visit, void *data);
+
+#ifdef PIECE_TABLE_IMPLEMENTATION
+
+static void pt_buffer_push_newline(Piece_Buffer *buf, size_t offset)
+{
+    if (buf->newlines_count >= buf->newlines_capacity) {
+        size_t new_capacity = buf->newlines_capacity;
+        if (new_capacity == 0) {
+            new_capacity = PIECE_TABLE_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+        buf->newlines = realloc(buf->newlines, new_capacity*sizeof(buf->newlines[0]));
+        buf->newlines_capacity = new_capacity;
+    }
+    buf->newlines[buf->newlines_count++] = offset;
+}
+
+static void pt_buffer_index_newlines(Piece_Buffer *buf, size_t begin, size_t end)
+{
+    const char *p = buf->data + begin;
+    const char *const last = buf->data + end;
+    while (p < last) {
+        const char *nl = memchr(p, '\n', last - p);
+        if (nl == NULL) {
+            break;
+        }
+        pt_buffer_push_newline(buf, nl - buf->data);
+        p = nl + 1;
+    }
+}
+
+static void pt_buffer_append(Piece_Buffer *buf, const char *text, size_t text_size)
+{
+    if (buf->capacity - buf->size < text_size) {
+        size_t new_capacity = buf->capacity;
+        if (new_capacity == 0) {
+            new_capacity = PIECE_TABLE_INIT_CAPACITY;
+        }
+        while (new_capacity - buf->size < text_size) {
+            new_capacity = new_capacity*2;
+        }
+        buf->data = realloc(buf->data, new_capacity);
+        buf->capacity = new_capacity;
+    }
+    memcpy(buf->data + buf->size, text, text_size);
+    buf->size += text_size;
+    pt_buffer_index_newlines(buf, buf->size - text_size, buf->size);
+}
+
+// Index of the first newline located at or after `offset`
+static size_t pt_buffer_lower_bound(const Piece_Buffer *buf, size_t offset)
+{
+    size_t lo = 0;
+    size_t hi = buf->newlines_count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo)/2;
+        if (buf->newlines[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static size_t pt_piece_count_newlines(const Piece_Table *pt, const Piece *piece)
+{
+    const Piece_Buffer *buf = &pt->buffers[piece->source];
+    return pt_buffer_lower_bound(buf, piece->start + piece->size)
+           - pt_buffer_lower_bound(buf, piece->start);
+}
+
+static void pt_insert_piece(Piece_Table *pt, size_t index, Piece piece)
+{
+    assert(index <= pt->pieces_count);
+    if (pt->pieces_count >= pt->pieces_capacity) {
+        size_t new_capacity = pt->pieces_capacity;
+        if (new_capacity == 0) {
+            new_capacity = PIECE_TABLE_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+        pt->pieces = realloc(pt->pieces, new_capacity*sizeof(pt->pieces[0]));
+        pt->pieces_capacity = new_capacity;
+    }
+    memmove(
+        pt->pieces + index + 1,
+        pt->pieces + index,
+        (pt->pieces_count - index)*sizeof(pt->pieces[0])
+    );
+    pt->pieces[index] = piece;
+    pt->pieces_count += 1;
+}
+
+// Recomputes the running totals of the pieces starting at `from`. Called
+// after every change to the pieces, which already moves the ones after it.
+static void pt_update_totals(Piece_Table *pt, size_t from)
+{
+    size_t end = from > 0 ? pt->pieces[from - 1].end : 0;
+    size_t newlines_end = from > 0 ? pt->pieces[from - 1].newlines_end : 0;
+    for (size_t i = from; i < pt->pieces_count; ++i) {
+        end += pt->pieces[i].size;
+        newlines_end += pt->pieces[i].newlines;
+        pt->pieces[i].end = end;
+        pt->pieces[i].newlines_end = newlines_end;
+    }
+}
+
+// Finds the piece that contains `offset`. Returns pieces_count if the
+// offset is at the very end of the document.
+static size_t pt_find_piece(const Piece_Table *pt, size_t offset, size_t *piece_begin)
+{
+    size_t lo = 0;
+    size_t hi = pt->pieces_count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo)/2;
+        if (pt->pieces[mid].end <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *piece_begin = lo > 0 ? pt->pieces[lo - 1].end : 0;
+    return lo;
+}
+
+// Finds the piece that contains the newline ending `row`. Returns
+// pieces_count if the document has no more than `row` newlines.
+static size_t pt_find_piece_by_row(const Piece_Table *pt, size_t row)
+{
+    size_t lo = 0;
+    size_t hi = pt->pieces_count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo)/2;
+        if (pt->pieces[mid].newlines_end <= row) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Makes sure that a piece boundary exists at `offset` and returns the
+// index of the piece that starts there.
+static size_t pt_split(Piece_Table *pt, size_t offset)
+{
+    size_t begin = 0;
+    const size_t index = pt_find_piece(pt, offset, &begin);
+    if (index >= pt->pieces_count || begin == offset) {
+        return index;
+    }
+
+    Piece *left = &pt->pieces[index];
+    Piece right = *left;
+    left->size = offset - begin;
+    right.start += left->size;
+    right.size -= left->size;
+    left->newlines = pt_piece_count_newlines(pt, left);
+    right.newlines -= left->newlines;
+    pt_insert_piece(pt, index + 1, right);
+    pt_update_totals(pt, index);
+    return index + 1;
+}
+
+// Takes ownership of `data` and of the offsets of all of its newlines
+void pt_load(Piece_Table *pt, char *data, size_t size, size_t *newlines, size_t newlines_count)
+{
+    assert(pt->pieces_count == 0 && "you can only load into an empty piece table");
+    Piece_Buffer *original = &pt->buffers[PIECE_ORIGINAL];
+    original->data = data;
+    original->size = size;
+    original->capacity = size;
+    original->newlines = newlines;
+    original->newlines_count = newlines_count;
+    original->newlines_capacity = newlines_count;
+
+    if (size > 0) {
+        pt_insert_piece(pt, 0, (Piece) {
+            .source = PIECE_ORIGINAL,
+            .start = 0,
+            .size = size,
+            .newlines = original->newlines_count,
+        });
+        pt_update_totals(pt, 0);
+    }
+    pt->size = size;
+    pt->newlines = original->newlines_count;
+}
+
+void pt_free(Piece_Table *pt)
+{
+    for (Piece_Source source = 0; source < COUNT_PIECE_SOURCES; ++source) {
+        free(pt->buffers[source].data);
+        free(pt->buffers[source].newlines);
+    }
+    free(pt->pieces);
+    memset(pt, 0, sizeof(*pt));
+}
+
+size_t pt_line_count(const Piece_Table *pt)
+{
+    return pt->newlines + 1;
+}
+
+size_t pt_line_offset(const Piece_Table *pt, size_t row)
+{
+    if (row == 0) {
+        return 0;
+    }
+    // The row starts right after newline number `row`, counting from 1
+    const size_t index = pt_find_piece_by_row(pt, row - 1);
+    if (index >= pt->pieces_count) {
+        return pt->size;
+    }
+    const Piece *piece = &pt->pieces[index];
+    const size_t offset = index > 0 ? pt->pieces[index - 1].end : 0;
+    row -= index > 0 ? pt->pieces[index - 1].newlines_end : 0;
+    const Piece_Buffer *buf = &pt->buffers[piece->source];
+    const size_t nl = buf->newlines[pt_buffer_lower_bound(buf, piece->start) + row - 1];
+    return offset + (nl - piece->start) + 1;
+}
+
+size_t pt_line_size(const Piece_Table *pt, size_t row)
+{
+    const size_t begin = pt_line_offset(pt, row);
+    if (row + 1 < pt_line_count(pt)) {
+        return pt_line_offset(pt, row + 1) - 1 - begin;
+    }
+    return pt->size - begin;
+}
+
+const char *pt_char_at(const Piece_Table *pt, size_t offset)
+{
+    size_t begin = 0;
+    const size_t index = pt_find_piece(pt, offset, &begin);
+    if (index >= pt->pieces_count) {
+        return NULL;
+    }
+    const Piece *piece = &pt->pieces[index];
+    return &pt->buffers[piece->source].data[piece->start + (offset - begin)];
+}
+
+void pt_insert(Piece_Table *pt, size_t offset, const char *text, size_t text_size)
+{
+    if (text_size == 0) {
+        return;
+    }
+    if (offset > pt->size) {
+        offset = pt->size;
+    }
+
+    Piece_Buffer *add = &pt->buffers[PIECE_ADD];
+    const size_t index = pt_split(pt, offset);
+    const size_t start = add->size;
+    const size_t newlines_before = add->newlines_count;
+    pt_buffer_append(add, text, text_size);
+    const size_t newlines = add->newlines_count - newlines_before;
+
+    // Consecutive typing keeps appending to the add buffer, so the piece
+    // right before the cursor can simply be extended.
+    Piece *prev = index > 0 ? &pt->pieces[index - 1] : NULL;
+    if (prev && prev->source == PIECE_ADD && prev->start + prev->size == start) {
+        prev->size += text_size;
+        prev->newlines += newlines;
+        pt_update_totals(pt, index - 1);
+    } else {
+        pt_insert_piece(pt, index, (Piece) {
+            .source = PIECE_ADD,
+            .start = start,
+            .size = text_size,
+            .newlines = newlines,
+        });
+        pt_update_totals(pt, index);
+    }
+
+    pt->size += text_size;
+    pt->newlines += newlines;
+}
+
+void pt_delete(Piece_Table *pt, size_t offset, size_t count)
+{
+    if (offset >= pt->size) {
+        return;
+    }
+    if (count > pt->size - offset) {
+        count = pt->size - offset;
+    }
+
+    const size_t begin = pt_split(pt, offset);
+    const size_t end = pt_split(pt, offset + count);
+    for (size_t i = begin; i < end; ++i) {
+        pt->newlines -= pt->pieces[i].newlines;
+    }
+    memmove(
+        pt->pieces + begin,
+        pt->pieces + end,
+        (pt->pieces_count - end)*sizeof(pt->pieces[0])
+    );
+    pt->pieces_count -= end - begin;
+    pt->size -= count;
+    pt_update_totals(pt, begin);
+}
+
+void pt_visit(const Piece_Table *pt, size_t offset, size_t count, Piece_Visitor visit, void *data)
+{
+    size_t begin = 0;
+    for (size_t i = pt_find_piece(pt, offset, &begin); i < pt->pieces_count && count > 0; ++i) {
+        const Piece *piece = &pt->pieces[i];
+        const size_t skip = offset > begin ? offset - begin : 0;
+        size_t n = piece->size - skip;
+        if (n > count) {
+            n = count;
+        }
+        visit(sv_from_parts(pt->buffers[piece->source].data + piece->start + skip, n), data);
+        count -= n;
+        begin += piece->size;
+    }
+}
+
+#endif // PIECE_TABLE_IMPLEMENTATION
+#endif // PIECE_TABLE_H_
@@ -0,0 +1,192 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <SDL2/SDL_timer.h>
+
+#define PROFILER_CAPACITY 512
+
+typedef enum {
+    // Loading, the window title and handling of the input events
+    PROFILER_PHASE_EVENTS = 0,
+    // Camera, viewport and filling the glyph buffer
+    PROFILER_PHASE_LAYOUT,
+    // Handing the glyphs over to the renderer. With OpenGL this is only
+    // the CPU side, the GPU catches up during the present.
+    PROFILER_PHASE_GLYPHS,
+    PROFILER_PHASE_PRESENT,
+    COUNT_PROFILER_PHASES,
+} Profiler_Phase;
+
+extern const char *const profiler_phase_names[COUNT_PROFILER_PHASES];
+
+typedef struct {
+    float phases_ms[COUNT_PROFILER_PHASES];
+    float total_ms;
+    // From the arrival of the oldest input event handled in the frame to
+    // the end of the present. Negative if the frame had no input.
+    float latency_ms;
+    // Of a save that finished during the frame, negative if there was none
+    float save_write_ms;
+    float save_fsync_ms;
+} Profiler_Frame;
+
+// Timings of the last PROFILER_CAPACITY frames, taken with the
+// performance counter since SDL_GetTicks() only has milliseconds.
+typedef struct {
+    Profiler_Frame frames[PROFILER_CAPACITY];
+    // Frames recorded so far, the latest one is at (count - 1)%PROFILER_CAPACITY
+    size_t count;
+    Profiler_Frame current;
+    Uint64 frame_start;
+    Uint64 last_mark;
+    bool has_input;
+    Uint64 input_arrival;
+    // The last save, which is usually older than the frames in the ring
+    size_t saves_count;
+    float last_save_write_ms;
+    float last_save_fsync_ms;
+} Profiler;
+
+void profiler_begin_frame(Profiler *profiler);
+void profiler_mark(Profiler *profiler, Profiler_Phase phase);
+void profiler_input(Profiler *profiler, Uint32 timestamp);
+void profiler_save(Profiler *profiler, float write_ms, float fsync_ms);
+float profiler_end_frame(Profiler *profiler);
+
+size_t profiler_frames_count(const Profiler *profiler);
+const Profiler_Frame *profiler_frame(const Profiler *profiler, size_t age);
+bool profiler_export(const Profiler *profiler, const char *file_path);
+
+#ifdef PROFILER_IMPLEMENTATION
+
+const char *const profiler_phase_names[COUNT_PROFILER_PHASES] = {
+    [PROFILER_PHASE_EVENTS]  = "events",
+    [PROFILER_PHASE_LAYOUT]  = "layout",
+    [PROFILER_PHASE_GLYPHS]  = "glyphs",
+    [PROFILER_PHASE_PRESENT] = "present",
+};
+
+static float profiler_ms(Uint64 begin, Uint64 end)
+{
+    return (float) ((double) (end - begin)*1000.0/SDL_GetPerformanceFrequency());
+}
+
+void profiler_begin_frame(Profiler *profiler)
+{
+    memset(&profiler->current, 0, sizeof(profiler->current));
+    profiler->current.save_write_ms = -1.0f;
+    profiler->current.save_fsync_ms = -1.0f;
+    profiler->frame_start = SDL_GetPerformanceCounter();
+    profiler->last_mark = profiler->frame_start;
+}
+
+// Adds the time since the previous mark to `phase`. A phase may be
+// marked several times per frame.
+void profiler_mark(Profiler *profiler, Profiler_Phase phase)
+{
+    const Uint64 now = SDL_GetPerformanceCounter();
+    profiler->current.phases_ms[phase] += profiler_ms(profiler->last_mark, now);
+    profiler->last_mark = now;
+}
+
+// `timestamp` is the SDL_GetTicks() time the event was queued at. It is
+// only precise to a millisecond, but it still accounts for the time the
+// event waited in the queue while the previous frame was being drawn.
+void profiler_input(Profiler *profiler, Uint32 timestamp)
+{
+    const Uint64 now = SDL_GetPerformanceCounter();
+    const Uint64 queued = (Uint64) (Uint32) (SDL_GetTicks() - timestamp)*SDL_GetPerformanceFrequency()/1000;
+    const Uint64 arrival = queued < now ? now - queued : 0;
+    if (!profiler->has_input || arrival < profiler->input_arrival) {
+        profiler->input_arrival = arrival;
+    }
+    profiler->has_input = true;
+}
+
+// The save is written on its own thread, so its time is not part of any
+// phase. It is only recorded with the frame that learned it was finished.
+void profiler_save(Profiler *profiler, float write_ms, float fsync_ms)
+{
+    profiler->current.save_write_ms = write_ms;
+    profiler->current.save_fsync_ms = fsync_ms;
+    profiler->saves_count += 1;
+    profiler->last_save_write_ms = write_ms;
+    profiler->last_save_fsync_ms = fsync_ms;
+}
+
+// Returns how long the frame took
+float profiler_end_frame(Profiler *profiler)
+{
+    const Uint64 now = SDL_GetPerformanceCounter();
+    Profiler_Frame *frame = &profiler->current;
+    frame->total_ms = profiler_ms(profiler->frame_start, now);
+    frame->latency_ms = -1.0f;
+    if (profiler->has_input) {
+        frame->latency_ms = profiler_ms(profiler->input_arrival, now);
+        profiler->has_input = false;
+    }
+    profiler->frames[profiler->count%PROFILER_CAPACITY] = *frame;
+    profiler->count += 1;
+    return frame->total_ms;
+}
+
+size_t profiler_frames_count(const Profiler *profiler)
+{
+    return profiler->count < PROFILER_CAPACITY ? profiler->count : PROFILER_CAPACITY;
+}
+
+// The frame `age` frames before the latest one
+const Profiler_Frame *profiler_frame(const Profiler *profiler, size_t age)
+{
+    if (age >= profiler_frames_count(profiler)) {
+        return NULL;
+    }
+    return &profiler->frames[(profiler->count - 1 - age)%PROFILER_CAPACITY];
+}
+
+// Writes the frames in the ring buffer as CSV, oldest first
+bool profiler_export(const Profiler *profiler, const char *file_path)
+{
+    FILE *file = fopen(file_path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: could not write %s: %s\n", file_path, strerror(errno));
+        return false;
+    }
+
+    fprintf(file, "frame");
+    for (Profiler_Phase phase = 0; phase < COUNT_PROFILER_PHASES; ++phase) {
+        fprintf(file, ",%s_ms", profiler_phase_names[phase]);
+    }
+    fprintf(file, ",total_ms,latency_ms,save_write_ms,save_fsync_ms\n");
+
+    const size_t n = profiler_frames_count(profiler);
+    for (size_t age = n; age-- > 0;) {
+        const Profiler_Frame *frame = profiler_frame(profiler, age);
+        fprintf(file, "%zu", profiler->count - 1 - age);
+        for (Profiler_Phase phase = 0; phase < COUNT_PROFILER_PHASES; ++phase) {
+            fprintf(file, ",%.4f", frame->phases_ms[phase]);
+        }
+        fprintf(file, ",%.4f,", frame->total_ms);
+        if (frame->latency_ms >= 0.0f) {
+            fprintf(file, "%.4f", frame->latency_ms);
+        }
+        fprintf(file, ",");
+        if (frame->save_write_ms >= 0.0f) {
+            fprintf(file, "%.4f,%.4f", frame->save_write_ms, frame->save_fsync_ms);
+        } else {
+            fprintf(file, ",");
+        }
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+    return true;
+}
+
+#endif // PROFILER_IMPLEMENTATION
+#endif // PROFILER_H_
@@ -0,0 +1,457 @@
+#ifndef ROPE_H_
+#define ROPE_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sv.h"
+
+#define ROPE_LEAF_CAP 1024
+#define ROPE_BRANCH_CAP 16
+
+// B-tree of text chunks. All of the leaves are on the same depth. Every
+// node caches the amount of bytes and newlines in its subtree, so both a
+// byte offset and a row can be found by descending from the root.
+typedef struct Rope_Node Rope_Node;
+
+struct Rope_Node {
+    bool leaf;
+    size_t count;
+    size_t size;
+    size_t newlines;
+    union {
+        Rope_Node *children[ROPE_BRANCH_CAP];
+        char text[ROPE_LEAF_CAP];
+    } as;
+};
+
+typedef struct {
+    Rope_Node *root;
+} Rope;
+
+typedef void (*Rope_Visitor)(String_View chunk, void *data);
+
+void rope_load(Rope *rope, const char *data, size_t size);
+void rope_free(Rope *rope);
+
+size_t rope_size(const Rope *rope);
+size_t rope_line_count(const Rope *rope);
+size_t rope_line_offset(const Rope *rope, size_t row);
+size_t rope_line_size(const Rope *rope, size_t row);
+const char *rope_char_at(const Rope *rope, size_t offset);
+
+void rope_insert(Rope *rope, size_t offset, const char *text, size_t text_size);
+void rope_delete(Rope *rope, size_t offset, size_t count);
+void rope_visit(const Rope *rope, size_t offset, size_t count, Rope_Visitor visit, void *data);
+
+#ifdef ROPE_IMPLEMENTATION
+
+static size_t rope_count_newlines(const char *text, size_t size)
+{
+    size_t newlines = 0;
+    const char *const end = text + size;
+    while (text < end && (text = memchr(text, '\n', end - text)) != NULL) {
+        newlines += 1;
+        text += 1;
+    }
+    return newlines;
+}
+
+static Rope_Node *rope_leaf_new(const char *text, size_t size)
+{
+    assert(size <= ROPE_LEAF_CAP);
+    Rope_Node *leaf = malloc(offsetof(Rope_Node, as) + ROPE_LEAF_CAP);
+    leaf->leaf = true;
+    leaf->count = size;
+    leaf->size = size;
+    leaf->newlines = 0;
+    if (size > 0) {
+        leaf->newlines = rope_count_newlines(text, size);
+        memcpy(leaf->as.text, text, size);
+    }
+    return leaf;
+}
+
+static Rope_Node *rope_branch_new(void)
+{
+    Rope_Node *branch = malloc(sizeof(Rope_Node));
+    branch->leaf = false;
+    branch->count = 0;
+    branch->size = 0;
+    branch->newlines = 0;
+    return branch;
+}
+
+static void rope_node_free(Rope_Node *node)
+{
+    if (!node->leaf) {
+        for (size_t i = 0; i < node->count; ++i) {
+            rope_node_free(node->as.children[i]);
+        }
+    }
+    free(node);
+}
+
+static void rope_branch_update(Rope_Node *branch)
+{
+    branch->size = 0;
+    branch->newlines = 0;
+    for (size_t i = 0; i < branch->count; ++i) {
+        branch->size += branch->as.children[i]->size;
+        branch->newlines += branch->as.children[i]->newlines;
+    }
+}
+
+static void rope_branch_insert_child(Rope_Node *branch, size_t index, Rope_Node *child)
+{
+    assert(branch->count < ROPE_BRANCH_CAP);
+    memmove(
+        branch->as.children + index + 1,
+        branch->as.children + index,
+        (branch->count - index)*sizeof(branch->as.children[0])
+    );
+    branch->as.children[index] = child;
+    branch->count += 1;
+}
+
+static void rope_branch_remove_child(Rope_Node *branch, size_t index)
+{
+    memmove(
+        branch->as.children + index,
+        branch->as.children + index + 1,
+        (branch->count - index - 1)*sizeof(branch->as.children[0])
+    );
+    branch->count -= 1;
+}
+
+// Inserts text that fits into half of a leaf. Returns the new right
+// sibling if the node had to be split.
+static Rope_Node *rope_node_insert(Rope_Node *node, size_t offset, const char *text, size_t text_size)
+{
+    assert(offset <= node->size);
+    if (node->leaf) {
+        if (node->count + text_size <= ROPE_LEAF_CAP) {
+            memmove(node->as.text + offset + text_size, node->as.text + offset, node->count - offset);
+            memcpy(node->as.text + offset, text, text_size);
+            node->count += text_size;
+            node->size += text_size;
+            node->newlines += rope_count_newlines(text, text_size);
+            return NULL;
+        }
+
+        char joined[ROPE_LEAF_CAP*2];
+        const size_t joined_size = node->count + text_size;
+        memcpy(joined, node->as.text, offset);
+        memcpy(joined + offset, text, text_size);
+        memcpy(joined + offset + text_size, node->as.text + offset, node->count - offset);
+
+        const size_t half = joined_size/2;
+        Rope_Node *right = rope_leaf_new(joined + half, joined_size - half);
+        memcpy(node->as.text, joined, half);
+        node->count = half;
+        node->size = half;
+        node->newlines = rope_count_newlines(node->as.text, half);
+        return right;
+    }
+
+    size_t index = 0;
+    while (index + 1 < node->count && offset > node->as.children[index]->size) {
+        offset -= node->as.children[index]->size;
+        index += 1;
+    }
+
+    Rope_Node *split = rope_node_insert(node->as.children[index], offset, text, text_size);
+    if (split == NULL) {
+        rope_branch_update(node);
+        return NULL;
+    }
+
+    if (node->count < ROPE_BRANCH_CAP) {
+        rope_branch_insert_child(node, index + 1, split);
+        rope_branch_update(node);
+        return NULL;
+    }
+
+    Rope_Node *right = rope_branch_new();
+    const size_t half = ROPE_BRANCH_CAP/2;
+    memcpy(right->as.children, node->as.children + half, (node->count - half)*sizeof(node->as.children[0]));
+    right->count = node->count - half;
+    node->count = half;
+    if (index + 1 <= half) {
+        rope_branch_insert_child(node, index + 1, split);
+    } else {
+        rope_branch_insert_child(right, index + 1 - half, split);
+    }
+    rope_branch_update(node);
+    rope_branch_update(right);
+    return right;
+}
+
+// Merges the children at `index` and `index + 1` if they fit into a
+// single node. Keeps the tree from filling up with tiny nodes after
+// deletions.
+static bool rope_branch_try_merge(Rope_Node *branch, size_t index)
+{
+    if (index + 1 >= branch->count) {
+        return false;
+    }
+    Rope_Node *a = branch->as.children[index];
+    Rope_Node *b = branch->as.children[index + 1];
+    if (a->leaf) {
+        if (a->count + b->count > ROPE_LEAF_CAP) {
+            return false;
+        }
+        memcpy(a->as.text + a->count, b->as.text, b->count);
+    } else {
+        if (a->count + b->count > ROPE_BRANCH_CAP) {
+            return false;
+        }
+        memcpy(a->as.children + a->count, b->as.children, b->count*sizeof(b->as.children[0]));
+    }
+    a->count += b->count;
+    a->size += b->size;
+    a->newlines += b->newlines;
+    free(b);
+    rope_branch_remove_child(branch, index + 1);
+    return true;
+}
+
+static void rope_node_delete(Rope_Node *node, size_t offset, size_t count)
+{
+    assert(offset + count <= node->size);
+    if (node->leaf) {
+        node->newlines -= rope_count_newlines(node->as.text + offset, count);
+        memmove(node->as.text + offset, node->as.text + offset + count, node->count - offset - count);
+        node->count -= count;
+        node->size -= count;
+        return;
+    }
+
+    size_t index = 0;
+    while (index < node->count && count > 0) {
+        Rope_Node *child = node->as.children[index];
+        if (offset >= child->size) {
+            offset -= child->size;
+            index += 1;
+            continue;
+        }
+
+        size_t n = child->size - offset;
+        if (n > count) {
+            n = count;
+        }
+        rope_node_delete(child, offset, n);
+        count -= n;
+        offset = 0;
+
+        if (child->size == 0) {
+            rope_node_free(child);
+            rope_branch_remove_child(node, index);
+        } else {
+            index += 1;
+        }
+    }
+
+    for (size_t i = 0; i + 1 < node->count;) {
+        if (!rope_branch_try_merge(node, i)) {
+            i += 1;
+        }
+    }
+    rope_branch_update(node);
+}
+
+void rope_load(Rope *rope, const char *data, size_t size)
+{
+    assert(rope->root == NULL && "you can only load into an empty rope");
+
+    size_t count = (size + ROPE_LEAF_CAP - 1)/ROPE_LEAF_CAP;
+    if (count == 0) {
+        rope->root = rope_leaf_new(data, 0);
+        return;
+    }
+
+    // Build the tree bottom-up, one level at a time, reusing the array of
+    // the level below for the nodes of the level above.
+    Rope_Node **nodes = malloc(count*sizeof(nodes[0]));
+    for (size_t i = 0; i < count; ++i) {
+        const size_t begin = i*ROPE_LEAF_CAP;
+        const size_t n = size - begin < ROPE_LEAF_CAP ? size - begin : ROPE_LEAF_CAP;
+        nodes[i] = rope_leaf_new(data + begin, n);
+    }
+    while (count > 1) {
+        const size_t parents_count = (count + ROPE_BRANCH_CAP - 1)/ROPE_BRANCH_CAP;
+        for (size_t i = 0; i < parents_count; ++i) {
+            Rope_Node *parent = rope_branch_new();
+            for (size_t j = i*ROPE_BRANCH_CAP; j < count && parent->count < ROPE_BRANCH_CAP; ++j) {
+                parent->as.children[parent->count++] = nodes[j];
+            }
+            rope_branch_update(parent);
+            nodes[i] = parent;
+        }
+        count = parents_count;
+    }
+    rope->root = nodes[0];
+    free(nodes);
+}
+
+void rope_free(Rope *rope)
+{
+    if (rope->root) {
+        rope_node_free(rope->root);
+    }
+    rope->root = NULL;
+}
+
+size_t rope_size(const Rope *rope)
+{
+    return rope->root ? rope->root->size : 0;
+}
+
+size_t rope_line_count(const Rope *rope)
+{
+    return (rope->root ? rope->root->newlines : 0) + 1;
+}
+
+size_t rope_line_offset(const Rope *rope, size_t row)
+{
+    if (row == 0 || rope->root == NULL) {
+        return 0;
+    }
+    if (row > rope->root->newlines) {
+        return rope->root->size;
+    }
+
+    size_t offset = 0;
+    const Rope_Node *node = rope->root;
+    while (!node->leaf) {
+        size_t index = 0;
+        while (row > node->as.children[index]->newlines) {
+            row -= node->as.children[index]->newlines;
+            offset += node->as.children[index]->size;
+            index += 1;
+        }
+        node = node->as.children[index];
+    }
+
+    const char *p = node->as.text;
+    for (;;) {
+        p = memchr(p, '\n', node->as.text + node->count - p);
+        assert(p != NULL);
+        p += 1;
+        if (--row == 0) {
+            return offset + (p - node->as.text);
+        }
+    }
+}
+
+size_t rope_line_size(const Rope *rope, size_t row)
+{
+    const size_t begin = rope_line_offset(rope, row);
+    if (row + 1 < rope_line_count(rope)) {
+        return rope_line_offset(rope, row + 1) - 1 - begin;
+    }
+    return rope_size(rope) - begin;
+}
+
+const char *rope_char_at(const Rope *rope, size_t offset)
+{
+    if (offset >= rope_size(rope)) {
+        return NULL;
+    }
+    const Rope_Node *node = rope->root;
+    while (!node->leaf) {
+        size_t index = 0;
+        while (offset >= node->as.children[index]->size) {
+            offset -= node->as.children[index]->size;
+            index += 1;
+        }
+        node = node->as.children[index];
+    }
+    return &node->as.text[offset];
+}
+
+void rope_insert(Rope *rope, size_t offset, const char *text, size_t text_size)
+{
+    if (rope->root == NULL) {
+        rope_load(rope, NULL, 0);
+    }
+    if (offset > rope->root->size) {
+        offset = rope->root->size;
+    }
+
+    // Big pastes go in as a sequence of half leaf sized pieces, so a single
+    // leaf split is always enough to make room for them.
+    while (text_size > 0) {
+        const size_t n = text_size < ROPE_LEAF_CAP/2 ? text_size : ROPE_LEAF_CAP/2;
+        Rope_Node *split = rope_node_insert(rope->root, offset, text, n);
+        if (split != NULL) {
+            Rope_Node *root = rope_branch_new();
+            root->as.children[root->count++] = rope->root;
+            root->as.children[root->count++] = split;
+            rope_branch_update(root);
+            rope->root = root;
+        }
+        offset += n;
+        text += n;
+        text_size -= n;
+    }
+}
+
+void rope_delete(Rope *rope, size_t offset, size_t count)
+{
+    const size_t size = rope_size(rope);
+    if (offset >= size) {
+        return;
+    }
+    if (count > size - offset) {
+        count = size - offset;
+    }
+
+    rope_node_delete(rope->root, offset, count);
+    while (!rope->root->leaf && rope->root->count <= 1) {
+        Rope_Node *root = rope->root;
+        if (root->count == 0) {
+            rope->root = rope_leaf_new(NULL, 0);
+        } else {
+            rope->root = root->as.children[0];
+        }
+        free(root);
+    }
+}
+
+static void rope_node_visit(const Rope_Node *node, size_t offset, size_t *count, Rope_Visitor visit, void *data)
+{
+    if (node->leaf) {
+        size_t n = node->count - offset;
+        if (n > *count) {
+            n = *count;
+        }
+        visit(sv_from_parts(node->as.text + offset, n), data);
+        *count -= n;
+        return;
+    }
+
+    for (size_t i = 0; i < node->count && *count > 0; ++i) {
+        const Rope_Node *child = node->as.children[i];
+        if (offset >= child->size) {
+            offset -= child->size;
+            continue;
+        }
+        rope_node_visit(child, offset, count, visit, data);
+        offset = 0;
+    }
+}
+
+void rope_visit(const Rope *rope, size_t offset, size_t count, Rope_Visitor visit, void *data)
+{
+    if (rope->root == NULL || offset >= rope->root->size || count == 0) {
+        return;
+    }
+    rope_node_visit(rope->root, offset, &count, visit, data);
+}
+
+#endif // ROPE_IMPLEMENTATION
+#endif // ROPE_H_
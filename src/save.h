@@ -0,0 +1,605 @@
+#ifndef SAVE_H_
+#define SAVE_H_
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "spans.h"
+
+#define SAVE_SNAPSHOT_INIT_CAPACITY 256
+#define SAVE_TEXT_BLOCK_SIZE (64*1024)
+// The most characters an int or an unsigned takes in the name of the
+// temporary file, the sign included
+#define SAVE_TEMP_NUMBER_SIZE 11
+// Segments smaller than this are copied into the staging buffer of the
+// writer instead of being handed to writev() on their own
+#define SAVE_GATHER_MAX_SIZE (4*1024)
+#define SAVE_STAGING_SIZE (1024*1024)
+// Segments handed to a single writev()
+#ifdef IOV_MAX
+#define SAVE_BATCH_SEGMENTS IOV_MAX
+#else
+#define SAVE_BATCH_SEGMENTS 1024
+#endif
+
+// The text of a document at one point in time as a list of segments in
+// file order. A segment points either into memory that is not modified
+// while the snapshot exists (a mapped file, the line arena, the original
+// buffer of a piece table) or into the text blocks of the snapshot, which
+// hold copies of whatever can still change. Adjacent segments are merged,
+// so a file that was not edited is a single segment however many lines it
+// has.
+//
+// A snapshot can also be a patch of the file that is already on disk. Its
+// segments then only cover the `ranges` of the file that changed, one
+// range after the other, and everything in between is left as it is.
+typedef struct {
+    size_t offset;
+    size_t size;
+} Save_Range;
+
+typedef struct {
+    struct iovec *segments;
+    size_t count;
+    size_t capacity;
+    // Blocks are never resized, so the segments pointing into them stay
+    // valid. Only the last one is still being filled.
+    char **blocks;
+    size_t blocks_count;
+    size_t blocks_capacity;
+    size_t block_size;
+    size_t block_capacity;
+    // Total size of the segments
+    size_t size;
+    bool patch;
+    Save_Range *ranges;
+    size_t ranges_count;
+    size_t ranges_capacity;
+    // The size of the file once it is patched
+    size_t file_size;
+} Save_Snapshot;
+
+// How hard a save makes sure the new contents survive a crash. The file
+// is always written next to the original and renamed over it, so a crash
+// in the middle of a save never leaves a half written file behind.
+typedef enum {
+    // fdatasync() the new file before it replaces the original, so after a
+    // crash the file has either the old or the new contents. The default.
+    SAVE_FSYNC_DATA = 0,
+    // Leave the flushing to the kernel. A crash shortly after the save can
+    // lose the new contents, and on some file systems the old ones too.
+    SAVE_FSYNC_NONE,
+    // fsync() the metadata of the file and the directory as well, so the
+    // save itself is durable once it is reported as done
+    SAVE_FSYNC_FULL,
+    COUNT_SAVE_FSYNCS,
+} Save_Fsync;
+
+extern const char *const save_fsync_names[COUNT_SAVE_FSYNCS];
+
+typedef struct {
+    // Everything but the flushing: creating, writing and renaming the file
+    float write_ms;
+    float fsync_ms;
+} Save_Timings;
+
+void save_snapshot_push(Save_Snapshot *snapshot, const char *data, size_t size);
+void save_snapshot_copy(Save_Snapshot *snapshot, const char *data, size_t size);
+void save_snapshot_seek(Save_Snapshot *snapshot, size_t offset);
+void save_snapshot_free(Save_Snapshot *snapshot);
+int save_snapshot_write(const Save_Snapshot *snapshot, const char *file_path,
+                        Save_Fsync fsync_policy, Save_Timings *timings);
+int save_patch_write(const Save_Snapshot *patch, const char *file_path,
+                     Save_Fsync fsync_policy, Save_Timings *timings, struct stat *after);
+
+// Writes a snapshot on a thread of its own, so that saving a big file does
+// not stop the editor. Only one snapshot is written at a time.
+typedef struct {
+    Save_Snapshot snapshot;
+    char *file_path;
+    Save_Fsync fsync_policy;
+    pthread_t thread;
+    // A snapshot was handed over and its result was not collected yet
+    bool busy;
+    bool running;
+    atomic_bool done;
+    // errno of the failed write, 0 on success
+    int error;
+    // Of the last snapshot that was written
+    Save_Timings timings;
+    bool patch;
+    // The patched file right after it was written
+    struct stat patched;
+} Save_Writer;
+
+void save_writer_start(Save_Writer *writer, Save_Snapshot snapshot, const char *file_path,
+                       Save_Fsync fsync_policy);
+bool save_writer_poll(Save_Writer *writer, int *error);
+void save_writer_wait(Save_Writer *writer, int *error);
+
+#ifdef SAVE_IMPLEMENTATION
+
+const char *const save_fsync_names[COUNT_SAVE_FSYNCS] = {
+    [SAVE_FSYNC_DATA] = "data",
+    [SAVE_FSYNC_NONE] = "none",
+    [SAVE_FSYNC_FULL] = "full",
+};
+
+static double save_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec*1e-6;
+}
+
+// Appends `data` to the snapshot without copying it, so it must stay
+// unmodified until the snapshot is freed
+void save_snapshot_push(Save_Snapshot *snapshot, const char *data, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+    snapshot->size += size;
+    if (snapshot->patch) {
+        assert(snapshot->ranges_count > 0 && "a patch has to seek before it is written to");
+        snapshot->ranges[snapshot->ranges_count - 1].size += size;
+    }
+    if (snapshot->count > 0) {
+        struct iovec *last = &snapshot->segments[snapshot->count - 1];
+        if ((const char*) last->iov_base + last->iov_len == data) {
+            last->iov_len += size;
+            return;
+        }
+    }
+
+    if (snapshot->count >= snapshot->capacity) {
+        size_t new_capacity = snapshot->capacity;
+        if (new_capacity == 0) {
+            new_capacity = SAVE_SNAPSHOT_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+        snapshot->segments = realloc(snapshot->segments, new_capacity*sizeof(snapshot->segments[0]));
+        snapshot->capacity = new_capacity;
+    }
+    snapshot->segments[snapshot->count++] = (struct iovec) {
+        .iov_base = (void*) data,
+        .iov_len = size,
+    };
+}
+
+// Appends a copy of `data`, for text that may change after the snapshot
+// is taken
+void save_snapshot_copy(Save_Snapshot *snapshot, const char *data, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+    if (snapshot->block_capacity - snapshot->block_size < size) {
+        if (snapshot->blocks_count >= snapshot->blocks_capacity) {
+            size_t new_capacity = snapshot->blocks_capacity;
+            if (new_capacity == 0) {
+                new_capacity = SAVE_SNAPSHOT_INIT_CAPACITY;
+            } else {
+                new_capacity = new_capacity*2;
+            }
+            snapshot->blocks = realloc(snapshot->blocks, new_capacity*sizeof(snapshot->blocks[0]));
+            snapshot->blocks_capacity = new_capacity;
+        }
+        const size_t capacity = size > SAVE_TEXT_BLOCK_SIZE ? size : SAVE_TEXT_BLOCK_SIZE;
+        snapshot->blocks[snapshot->blocks_count++] = malloc(capacity);
+        snapshot->block_size = 0;
+        snapshot->block_capacity = capacity;
+    }
+    char *copy = snapshot->blocks[snapshot->blocks_count - 1] + snapshot->block_size;
+    memcpy(copy, data, size);
+    snapshot->block_size += size;
+    save_snapshot_push(snapshot, copy, size);
+}
+
+// Makes the following segments of a patch go to `offset` of the file.
+// Offsets only ever grow.
+void save_snapshot_seek(Save_Snapshot *snapshot, size_t offset)
+{
+    assert(snapshot->patch);
+    if (snapshot->ranges_count > 0) {
+        Save_Range *last = &snapshot->ranges[snapshot->ranges_count - 1];
+        assert(offset >= last->offset + last->size);
+        if (last->offset + last->size == offset) {
+            return;
+        }
+    }
+    if (snapshot->ranges_count >= snapshot->ranges_capacity) {
+        size_t new_capacity = snapshot->ranges_capacity;
+        if (new_capacity == 0) {
+            new_capacity = SAVE_SNAPSHOT_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+        snapshot->ranges = realloc(snapshot->ranges, new_capacity*sizeof(snapshot->ranges[0]));
+        snapshot->ranges_capacity = new_capacity;
+    }
+    snapshot->ranges[snapshot->ranges_count++] = (Save_Range) {
+        .offset = offset,
+        .size = 0,
+    };
+}
+
+void save_snapshot_free(Save_Snapshot *snapshot)
+{
+    for (size_t i = 0; i < snapshot->blocks_count; ++i) {
+        free(snapshot->blocks[i]);
+    }
+    free(snapshot->blocks);
+    free(snapshot->segments);
+    free(snapshot->ranges);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+// Segments are handed to writev() SAVE_BATCH_SEGMENTS at a time. The
+// small ones, like edited lines in between unedited stretches of a file,
+// are first gathered into a staging buffer, so a file with millions of
+// edited lines still takes one syscall per megabyte or so.
+typedef struct {
+    int fd;
+    struct iovec batch[SAVE_BATCH_SEGMENTS];
+    size_t count;
+    char *staging;
+    size_t staging_size;
+} Save_Stream;
+
+static int save_stream_flush(Save_Stream *stream)
+{
+    struct iovec *iov = stream->batch;
+    size_t count = stream->count;
+    while (count > 0) {
+        const ssize_t written = writev(stream->fd, iov, (int) count);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return written < 0 ? errno : EIO;
+        }
+        // Resume a short write where it stopped
+        size_t left = (size_t) written;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov += 1;
+            count -= 1;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*) iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    stream->count = 0;
+    stream->staging_size = 0;
+    return 0;
+}
+
+static int save_stream_write(Save_Stream *stream, const char *data, size_t size)
+{
+    const bool gather = size < SAVE_GATHER_MAX_SIZE;
+    if (stream->count == SAVE_BATCH_SEGMENTS
+            || (gather && SAVE_STAGING_SIZE - stream->staging_size < size)) {
+        const int error = save_stream_flush(stream);
+        if (error != 0) {
+            return error;
+        }
+    }
+    if (gather) {
+        char *copy = stream->staging + stream->staging_size;
+        memcpy(copy, data, size);
+        stream->staging_size += size;
+        data = copy;
+    }
+
+    if (stream->count > 0) {
+        struct iovec *last = &stream->batch[stream->count - 1];
+        if ((const char*) last->iov_base + last->iov_len == data) {
+            last->iov_len += size;
+            return 0;
+        }
+    }
+    stream->batch[stream->count++] = (struct iovec) {
+        .iov_base = (void*) data,
+        .iov_len = size,
+    };
+    return 0;
+}
+
+static int save_write_segments(int fd, const Save_Snapshot *snapshot)
+{
+    Save_Stream stream = {
+        .fd = fd,
+        .staging = malloc(SAVE_STAGING_SIZE),
+    };
+    int error = 0;
+    for (size_t i = 0; i < snapshot->count && error == 0; ++i) {
+        error = save_stream_write(&stream, snapshot->segments[i].iov_base, snapshot->segments[i].iov_len);
+    }
+    if (error == 0) {
+        error = save_stream_flush(&stream);
+    }
+    free(stream.staging);
+    return error;
+}
+
+static int save_sync_directory(const char *file_path)
+{
+    const char *slash = strrchr(file_path, '/');
+    char *dir = slash ? strndup(file_path, slash == file_path ? 1 : slash - file_path) : strdup(".");
+    const int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    free(dir);
+    if (fd < 0) {
+        return errno;
+    }
+    const int error = fsync(fd) < 0 ? errno : 0;
+    close(fd);
+    return error;
+}
+
+// Returns 0 on success and errno otherwise. The snapshot goes into a new
+// file next to `file_path`, which is renamed over it once it is complete
+// and flushed according to `fsync_policy`. The new file gets the
+// permissions of the one it replaces. Symbolic links are followed, so the
+// file they point to is replaced rather than the link.
+int save_snapshot_write(const Save_Snapshot *snapshot, const char *file_path,
+                        Save_Fsync fsync_policy, Save_Timings *timings)
+{
+    SPAN("save_snapshot_write");
+    assert(!snapshot->patch && "patches are written with save_patch_write()");
+    static atomic_uint temp_counter = 0;
+    const double start = save_now_ms();
+    double fsync_ms = 0.0;
+
+    char *target = realpath(file_path, NULL);
+    if (target == NULL) {
+        target = strdup(file_path);
+    }
+    // `dir/.name.<pid>-<counter>.tmp`
+    const char *slash = strrchr(target, '/');
+    const size_t dir_size = slash ? (size_t) (slash - target + 1) : 0;
+    const char *name = target + dir_size;
+    const size_t temp_size = dir_size + strlen(name) + sizeof("..-.tmp") + 2*SAVE_TEMP_NUMBER_SIZE;
+    char *temp = malloc(temp_size);
+    memcpy(temp, target, dir_size);
+    const int temp_name_size = snprintf(temp + dir_size, temp_size - dir_size, ".%s.%d-%u.tmp", name,
+                                        (int) getpid(), atomic_fetch_add(&temp_counter, 1));
+    int error = 0;
+    if (temp_name_size < 0 || (size_t) temp_name_size >= temp_size - dir_size) {
+        error = ENAMETOOLONG;
+    }
+
+    struct stat st;
+    const bool exists = stat(target, &st) == 0;
+    int fd = -1;
+    if (error == 0) {
+        fd = open(temp, O_WRONLY | O_CREAT | O_EXCL, exists ? st.st_mode & 07777 : 0666);
+        if (fd < 0) {
+            error = errno;
+        }
+    }
+    if (error == 0 && exists) {
+        // The mode passed to open() is masked by the umask
+        if (fchmod(fd, st.st_mode & 07777) < 0) {
+            error = errno;
+        }
+        // Only root can give the file away, so the owner is kept if possible
+        if (st.st_uid != geteuid() || st.st_gid != getegid()) {
+            const int ignored = fchown(fd, st.st_uid, st.st_gid);
+            (void) ignored;
+        }
+    }
+    if (error == 0) {
+        error = save_write_segments(fd, snapshot);
+    }
+    if (error == 0 && fsync_policy != SAVE_FSYNC_NONE) {
+        const double fsync_start = save_now_ms();
+        const int result = fsync_policy == SAVE_FSYNC_FULL ? fsync(fd) : fdatasync(fd);
+        if (result < 0) {
+            error = errno;
+        }
+        fsync_ms += save_now_ms() - fsync_start;
+    }
+    if (fd >= 0 && close(fd) < 0 && error == 0) {
+        error = errno;
+    }
+    if (error == 0 && rename(temp, target) < 0) {
+        error = errno;
+    }
+    if (error == 0 && fsync_policy == SAVE_FSYNC_FULL) {
+        const double fsync_start = save_now_ms();
+        error = save_sync_directory(target);
+        fsync_ms += save_now_ms() - fsync_start;
+    }
+    if (error != 0 && fd >= 0) {
+        unlink(temp);
+    }
+    free(temp);
+    free(target);
+
+    timings->fsync_ms = (float) fsync_ms;
+    timings->write_ms = (float) (save_now_ms() - start - fsync_ms);
+    return error;
+}
+
+// Moves `*next` and `*skip`, the segment and the offset inside of it,
+// `size` bytes further
+static void save_segments_advance(const Save_Snapshot *snapshot, size_t *next, size_t *skip, size_t size)
+{
+    size += *skip;
+    while (*next < snapshot->count && size >= snapshot->segments[*next].iov_len) {
+        size -= snapshot->segments[*next].iov_len;
+        *next += 1;
+    }
+    *skip = size;
+}
+
+static int save_write_ranges(int fd, const Save_Snapshot *patch)
+{
+    struct iovec batch[SAVE_BATCH_SEGMENTS];
+    size_t next = 0;
+    size_t skip = 0;
+    for (size_t r = 0; r < patch->ranges_count; ++r) {
+        size_t offset = patch->ranges[r].offset;
+        size_t left = patch->ranges[r].size;
+        while (left > 0) {
+            // Segments are merged by address, so one may span two ranges
+            size_t n = 0;
+            size_t batch_size = 0;
+            size_t i = next;
+            size_t s = skip;
+            while (n < SAVE_BATCH_SEGMENTS && batch_size < left) {
+                assert(i < patch->count);
+                size_t size = patch->segments[i].iov_len - s;
+                if (size > left - batch_size) {
+                    size = left - batch_size;
+                }
+                batch[n++] = (struct iovec) {
+                    .iov_base = (char*) patch->segments[i].iov_base + s,
+                    .iov_len = size,
+                };
+                batch_size += size;
+                i += 1;
+                s = 0;
+            }
+
+            const ssize_t written = pwritev(fd, batch, (int) n, (off_t) offset);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return written < 0 ? errno : EIO;
+            }
+            save_segments_advance(patch, &next, &skip, (size_t) written);
+            offset += (size_t) written;
+            left -= (size_t) written;
+        }
+    }
+    return 0;
+}
+
+// Writes the ranges of the patch into the file in place and truncates it
+// to its new size. Unlike save_snapshot_write() this is not atomic: a
+// crash in the middle leaves the file partially patched, which is why
+// patches are kept small. `after` is the file right after the patch, so
+// that the next patch can tell whether somebody else changed it since.
+int save_patch_write(const Save_Snapshot *patch, const char *file_path,
+                     Save_Fsync fsync_policy, Save_Timings *timings, struct stat *after)
+{
+    SPAN("save_patch_write");
+    assert(patch->patch);
+    const double start = save_now_ms();
+    double fsync_ms = 0.0;
+
+    const int fd = open(file_path, O_WRONLY);
+    if (fd < 0) {
+        return errno;
+    }
+    int error = save_write_ranges(fd, patch);
+    if (error == 0 && fstat(fd, after) == 0 && (size_t) after->st_size > patch->file_size
+            && ftruncate(fd, (off_t) patch->file_size) < 0) {
+        error = errno;
+    }
+    if (error == 0 && fsync_policy != SAVE_FSYNC_NONE) {
+        const double fsync_start = save_now_ms();
+        const int result = fsync_policy == SAVE_FSYNC_FULL ? fsync(fd) : fdatasync(fd);
+        if (result < 0) {
+            error = errno;
+        }
+        fsync_ms += save_now_ms() - fsync_start;
+    }
+    if (error == 0 && fstat(fd, after) < 0) {
+        error = errno;
+    }
+    if (close(fd) < 0 && error == 0) {
+        error = errno;
+    }
+
+    timings->fsync_ms = (float) fsync_ms;
+    timings->write_ms = (float) (save_now_ms() - start - fsync_ms);
+    return error;
+}
+
+static void *save_writer_thread(void *arg)
+{
+    Save_Writer *writer = arg;
+    if (writer->patch) {
+        writer->error = save_patch_write(&writer->snapshot, writer->file_path,
+                                         writer->fsync_policy, &writer->timings, &writer->patched);
+    } else {
+        writer->error = save_snapshot_write(&writer->snapshot, writer->file_path,
+                                            writer->fsync_policy, &writer->timings);
+    }
+    atomic_store(&writer->done, true);
+    return NULL;
+}
+
+// Takes ownership of the snapshot
+void save_writer_start(Save_Writer *writer, Save_Snapshot snapshot, const char *file_path,
+                       Save_Fsync fsync_policy)
+{
+    assert(!writer->busy && "a snapshot is already being written");
+    writer->snapshot = snapshot;
+    writer->file_path = strdup(file_path);
+    writer->fsync_policy = fsync_policy;
+    writer->patch = snapshot.patch;
+    writer->busy = true;
+    writer->error = 0;
+    atomic_store(&writer->done, false);
+    writer->running = pthread_create(&writer->thread, NULL, save_writer_thread, writer) == 0;
+    if (!writer->running) {
+        save_writer_thread(writer);
+    }
+}
+
+static void save_writer_finish(Save_Writer *writer, int *error)
+{
+    if (writer->running) {
+        pthread_join(writer->thread, NULL);
+        writer->running = false;
+    }
+    *error = writer->error;
+    save_snapshot_free(&writer->snapshot);
+    free(writer->file_path);
+    writer->file_path = NULL;
+    writer->busy = false;
+}
+
+// Returns true once per snapshot, as soon as it is written. `error` is
+// then the errno of the failure or 0.
+bool save_writer_poll(Save_Writer *writer, int *error)
+{
+    if (!writer->busy || !atomic_load(&writer->done)) {
+        return false;
+    }
+    save_writer_finish(writer, error);
+    return true;
+}
+
+// Blocks until the snapshot being written, if any, is on disk
+void save_writer_wait(Save_Writer *writer, int *error)
+{
+    *error = 0;
+    if (writer->busy) {
+        save_writer_finish(writer, error);
+    }
+}
+
+#endif // SAVE_IMPLEMENTATION
+#endif // SAVE_H_
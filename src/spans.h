@@ -0,0 +1,140 @@
+#ifndef SPANS_H_
+#define SPANS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timed scopes written as Chrome trace events, which can be opened in
+// chrome://tracing or https://ui.perfetto.dev. They only exist when the
+// editor is compiled with -DSPANS (`make SPANS=1`), otherwise SPAN()
+// expands to nothing. Even when compiled in, nothing is recorded until
+// spans_start() is called.
+//
+//     void foo(void)
+//     {
+//         SPAN("foo");
+//         ...
+//     } // the span ends here, on any return
+#ifdef SPANS
+typedef struct {
+    // NULL if nothing was being recorded when the span began
+    const char *name;
+    uint64_t begin_us;
+} Span;
+
+Span span_begin(const char *name);
+void span_end(Span *span);
+
+#define SPAN_CONCAT_(a, b) a##b
+#define SPAN_CONCAT(a, b) SPAN_CONCAT_(a, b)
+#define SPAN(name) \
+    Span SPAN_CONCAT(span_, __LINE__) __attribute__((cleanup(span_end))) = span_begin(name)
+#else
+#define SPAN(name)
+#endif // SPANS
+
+bool spans_start(const char *file_path);
+void spans_stop(void);
+
+#ifdef SPANS_IMPLEMENTATION
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef SPANS
+static pthread_mutex_t spans_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *spans_file = NULL;
+static bool spans_first = true;
+static uint64_t spans_start_us = 0;
+static atomic_bool spans_recording = false;
+static atomic_int spans_next_tid = 1;
+static _Thread_local int spans_tid = 0;
+
+static uint64_t spans_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+Span span_begin(const char *name)
+{
+    Span span = {0};
+    if (atomic_load_explicit(&spans_recording, memory_order_relaxed)) {
+        span.name = name;
+        span.begin_us = spans_now_us();
+    }
+    return span;
+}
+
+// Spans are written as complete ("X") events once they end, so a span
+// that is still open when the recording stops is lost
+void span_end(Span *span)
+{
+    if (span->name == NULL) {
+        return;
+    }
+    const uint64_t end_us = spans_now_us();
+    if (spans_tid == 0) {
+        spans_tid = atomic_fetch_add(&spans_next_tid, 1);
+    }
+
+    pthread_mutex_lock(&spans_mutex);
+    if (spans_file != NULL && span->begin_us >= spans_start_us) {
+        fprintf(spans_file,
+                "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %llu, \"dur\": %llu, \"pid\": 1, \"tid\": %d}",
+                spans_first ? "" : ",", span->name,
+                (unsigned long long) (span->begin_us - spans_start_us),
+                (unsigned long long) (end_us - span->begin_us), spans_tid);
+        spans_first = false;
+    }
+    pthread_mutex_unlock(&spans_mutex);
+}
+#endif // SPANS
+
+bool spans_start(const char *file_path)
+{
+#ifdef SPANS
+    spans_stop();
+    pthread_mutex_lock(&spans_mutex);
+    spans_file = fopen(file_path, "w");
+    if (spans_file == NULL) {
+        pthread_mutex_unlock(&spans_mutex);
+        fprintf(stderr, "ERROR: could not write %s: %s\n", file_path, strerror(errno));
+        return false;
+    }
+    // The JSON Array Format of the trace events, whose closing bracket is
+    // optional, so the file is still usable if the editor crashes
+    fprintf(spans_file, "[");
+    spans_first = true;
+    spans_start_us = spans_now_us();
+    atomic_store(&spans_recording, true);
+    pthread_mutex_unlock(&spans_mutex);
+    return true;
+#else
+    (void) file_path;
+    fprintf(stderr, "ERROR: spans are compiled out, rebuild with `make -B SPANS=1`\n");
+    return false;
+#endif // SPANS
+}
+
+void spans_stop(void)
+{
+#ifdef SPANS
+    pthread_mutex_lock(&spans_mutex);
+    atomic_store(&spans_recording, false);
+    if (spans_file != NULL) {
+        fprintf(spans_file, "\n]\n");
+        fclose(spans_file);
+        spans_file = NULL;
+    }
+    pthread_mutex_unlock(&spans_mutex);
+#endif // SPANS
+}
+
+#endif // SPANS_IMPLEMENTATION
+#endif // SPANS_H_
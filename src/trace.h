@@ -0,0 +1,341 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "editor.h"
+
+// Enough for any SDL_TEXTINPUT event, SDL_TEXTINPUTEVENT_TEXT_SIZE is 32
+#define TRACE_TEXT_CAPACITY 32
+#define TRACE_VERSION 1
+
+typedef enum {
+    TRACE_EVENT_KEY = 0,
+    TRACE_EVENT_TEXT,
+} Trace_Event_Kind;
+
+typedef enum {
+    TRACE_KEY_TAB = 0,
+    TRACE_KEY_BACKSPACE,
+    TRACE_KEY_DELETE,
+    TRACE_KEY_UP,
+    TRACE_KEY_DOWN,
+    TRACE_KEY_LEFT,
+    TRACE_KEY_RIGHT,
+    TRACE_KEY_RETURN,
+    TRACE_KEY_SAVE,
+    TRACE_KEY_UNDO,
+    TRACE_KEY_REDO,
+    COUNT_TRACE_KEYS,
+} Trace_Key;
+
+// An input event as the editor sees it. The frontend translates SDL
+// events into these, so a recorded session goes through exactly the same
+// code when it is replayed without a window.
+typedef struct {
+    // Microseconds since the recording started
+    uint64_t time_us;
+    Trace_Event_Kind kind;
+    Trace_Key key;
+    // NULL-terminated
+    char text[TRACE_TEXT_CAPACITY];
+} Trace_Event;
+
+// A trace is a header followed by one record per event:
+//
+//   header: "BNTR", u8 version, u8 backend, u16 file path size, file path
+//   record: varint microseconds since the previous event, u8 tag,
+//           followed by `tag & 0x7f` bytes of text if the top bit is set.
+//           Otherwise the tag is a Trace_Key.
+//
+// So a typed character usually takes 3 or 4 bytes.
+typedef struct {
+    FILE *file;
+    uint64_t start_us;
+    uint64_t last_us;
+} Trace_Writer;
+
+typedef struct {
+    FILE *file;
+    uint64_t last_us;
+    Editor_Backend backend;
+    // The file that was open in the recorded session, NULL if none
+    char *file_path;
+} Trace_Reader;
+
+bool trace_can_apply(const Editor *editor, const Trace_Event *event);
+void trace_apply(Editor *editor, const Trace_Event *event, const char *file_path);
+
+bool trace_writer_open(Trace_Writer *writer, const char *path, Editor_Backend backend, const char *file_path);
+void trace_write(Trace_Writer *writer, Trace_Event *event);
+void trace_writer_close(Trace_Writer *writer);
+
+bool trace_reader_open(Trace_Reader *reader, const char *path);
+bool trace_read(Trace_Reader *reader, Trace_Event *event);
+void trace_reader_close(Trace_Reader *reader);
+
+uint64_t trace_now_us(void);
+
+#ifdef TRACE_IMPLEMENTATION
+
+#define TRACE_TEXT_TAG 0x80
+
+uint64_t trace_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+// Whether the event can be applied without waiting for the file to load.
+// Edits need the document to be editable and a save needs all of it.
+bool trace_can_apply(const Editor *editor, const Trace_Event *event)
+{
+    if (event->kind == TRACE_EVENT_KEY) {
+        switch (event->key) {
+        case TRACE_KEY_UP:
+        case TRACE_KEY_DOWN:
+        case TRACE_KEY_LEFT:
+        case TRACE_KEY_RIGHT:
+            return true;
+        case TRACE_KEY_SAVE:
+            return !editor_loading(editor);
+        default:
+            break;
+        }
+    }
+    return editor_editable(editor);
+}
+
+void trace_apply(Editor *editor, const Trace_Event *event, const char *file_path)
+{
+    switch (event->kind) {
+    case TRACE_EVENT_TEXT: {
+        editor_insert_text_before_cursor(editor, event->text);
+    } break;
+    case TRACE_EVENT_KEY: {
+        switch (event->key) {
+        case TRACE_KEY_TAB: {
+            editor_insert_text_before_cursor(editor, "  ");
+        } break;
+        case TRACE_KEY_BACKSPACE: {
+            editor_backspace(editor);
+        } break;
+        case TRACE_KEY_DELETE: {
+            editor_delete(editor);
+        } break;
+        case TRACE_KEY_UP: {
+            undo_seal(&editor->undo);
+            if (editor->cursor_row > 0) {
+                editor->cursor_row -= 1;
+            }
+        } break;
+        case TRACE_KEY_DOWN: {
+            undo_seal(&editor->undo);
+            if (editor->cursor_row < editor_line_count(editor)) {
+                editor->cursor_row += 1;
+            }
+        } break;
+        case TRACE_KEY_LEFT: {
+            undo_seal(&editor->undo);
+            if (editor->cursor_col > 0) {
+                editor->cursor_col -= 1;
+            }
+        } break;
+        case TRACE_KEY_RIGHT: {
+            undo_seal(&editor->undo);
+            if (editor->cursor_col < 80) {
+                editor->cursor_col += 1;
+            }
+        } break;
+        case TRACE_KEY_RETURN: {
+            editor_insert_new_line(editor);
+        } break;
+        case TRACE_KEY_SAVE: {
+            if (file_path) {
+                editor_save_start(editor, file_path);
+            }
+        } break;
+        case TRACE_KEY_UNDO: {
+            editor_undo(editor);
+        } break;
+        case TRACE_KEY_REDO: {
+            editor_redo(editor);
+        } break;
+        case COUNT_TRACE_KEYS:
+        default:
+            assert(0 && "unreachable");
+        }
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+static void trace_write_varint(FILE *file, uint64_t x)
+{
+    while (x >= 0x80) {
+        fputc((int) (x & 0x7f) | 0x80, file);
+        x >>= 7;
+    }
+    fputc((int) x, file);
+}
+
+static bool trace_read_varint(FILE *file, uint64_t *x)
+{
+    *x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const int b = fgetc(file);
+        if (b == EOF) {
+            return false;
+        }
+        *x |= (uint64_t) (b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool trace_writer_open(Trace_Writer *writer, const char *path, Editor_Backend backend, const char *file_path)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) {
+        fprintf(stderr, "ERROR: could not create trace %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    size_t file_path_size = file_path ? strlen(file_path) : 0;
+    if (file_path_size > UINT16_MAX) {
+        file_path_size = UINT16_MAX;
+    }
+    fwrite("BNTR", 1, 4, writer->file);
+    fputc(TRACE_VERSION, writer->file);
+    fputc((int) backend, writer->file);
+    fputc((int) (file_path_size & 0xff), writer->file);
+    fputc((int) (file_path_size >> 8), writer->file);
+    if (file_path_size > 0) {
+        fwrite(file_path, 1, file_path_size, writer->file);
+    }
+
+    writer->start_us = trace_now_us();
+    return true;
+}
+
+// Stamps the event with the current time and appends it to the trace
+void trace_write(Trace_Writer *writer, Trace_Event *event)
+{
+    event->time_us = trace_now_us() - writer->start_us;
+    trace_write_varint(writer->file, event->time_us - writer->last_us);
+    writer->last_us = event->time_us;
+
+    switch (event->kind) {
+    case TRACE_EVENT_KEY: {
+        fputc((int) event->key, writer->file);
+    } break;
+    case TRACE_EVENT_TEXT: {
+        const size_t size = strlen(event->text);
+        fputc(TRACE_TEXT_TAG | (int) size, writer->file);
+        fwrite(event->text, 1, size, writer->file);
+    } break;
+    default:
+        assert(0 && "unreachable");
+    }
+}
+
+void trace_writer_close(Trace_Writer *writer)
+{
+    if (writer->file) {
+        fclose(writer->file);
+    }
+    memset(writer, 0, sizeof(*writer));
+}
+
+bool trace_reader_open(Trace_Reader *reader, const char *path)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        fprintf(stderr, "ERROR: could not open trace %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    unsigned char header[8];
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header)
+            || memcmp(header, "BNTR", 4) != 0) {
+        fprintf(stderr, "ERROR: %s is not a trace\n", path);
+        trace_reader_close(reader);
+        return false;
+    }
+    if (header[4] != TRACE_VERSION) {
+        fprintf(stderr, "ERROR: %s: unsupported trace version %d\n", path, header[4]);
+        trace_reader_close(reader);
+        return false;
+    }
+    reader->backend = (Editor_Backend) header[5];
+
+    const size_t file_path_size = header[6] | (header[7] << 8);
+    if (file_path_size > 0) {
+        reader->file_path = malloc(file_path_size + 1);
+        if (fread(reader->file_path, 1, file_path_size, reader->file) != file_path_size) {
+            fprintf(stderr, "ERROR: %s: truncated header\n", path);
+            trace_reader_close(reader);
+            return false;
+        }
+        reader->file_path[file_path_size] = '\0';
+    }
+    return true;
+}
+
+// Returns false at the end of the trace. A truncated last record, which
+// is what a crashed session leaves behind, is treated as the end.
+bool trace_read(Trace_Reader *reader, Trace_Event *event)
+{
+    memset(event, 0, sizeof(*event));
+    uint64_t delta_us = 0;
+    if (!trace_read_varint(reader->file, &delta_us)) {
+        return false;
+    }
+    const int tag = fgetc(reader->file);
+    if (tag == EOF) {
+        return false;
+    }
+
+    if (tag & TRACE_TEXT_TAG) {
+        const size_t size = tag & ~TRACE_TEXT_TAG;
+        if (size >= TRACE_TEXT_CAPACITY
+                || fread(event->text, 1, size, reader->file) != size) {
+            return false;
+        }
+        event->kind = TRACE_EVENT_TEXT;
+    } else {
+        if (tag >= COUNT_TRACE_KEYS) {
+            return false;
+        }
+        event->kind = TRACE_EVENT_KEY;
+        event->key = (Trace_Key) tag;
+    }
+
+    reader->last_us += delta_us;
+    event->time_us = reader->last_us;
+    return true;
+}
+
+void trace_reader_close(Trace_Reader *reader)
+{
+    if (reader->file) {
+        fclose(reader->file);
+    }
+    free(reader->file_path);
+    memset(reader, 0, sizeof(*reader));
+}
+
+#endif // TRACE_IMPLEMENTATION
+#endif // TRACE_H_
@@ -0,0 +1,259 @@
+#ifndef UNDO_H_
+#define UNDO_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNDO_INIT_CAPACITY 256
+// Used when `max_size` of the journal is 0
+#define UNDO_DEFAULT_MAX_SIZE (64*1024*1024)
+
+typedef enum {
+    // `text` was inserted at row:col
+    UNDO_INSERT = 0,
+    // `text` was deleted at row:col by deleting forward
+    UNDO_DELETE,
+    // `text` was deleted by backspacing until the cursor was at row:col.
+    // The text is journaled the other way around, last deleted last.
+    UNDO_BACKSPACE,
+    // An empty line was inserted after `row`
+    UNDO_NEW_LINE,
+} Undo_Kind;
+
+// One edit as the difference it made to the document, never a copy of
+// the document. Consecutive edits of the same kind that continue each
+// other (typing, holding backspace) grow a single record.
+typedef struct {
+    Undo_Kind kind;
+    size_t row;
+    size_t col;
+    // Into the text of the journal
+    size_t text_offset;
+    size_t text_size;
+    // The rows an UNDO_INSERT added after `row` because the text did not
+    // fit in it, see editor_lines_insert(). Such a record never grows.
+    size_t rows;
+} Undo_Record;
+
+// Append-only: records[first..applied) can be undone, records[applied..count)
+// redone. A new edit drops the ones that could be redone. Once the journal
+// takes more than `max_size` bytes the oldest records are forgotten.
+typedef struct {
+    Undo_Record *records;
+    size_t first;
+    size_t applied;
+    size_t count;
+    size_t capacity;
+    char *text;
+    size_t text_first;
+    size_t text_size;
+    size_t text_capacity;
+    size_t max_size;
+    // The last record may still grow
+    bool open;
+} Undo_Journal;
+
+void undo_record(Undo_Journal *journal, Undo_Kind kind, size_t row, size_t col,
+                 const char *text, size_t text_size, size_t rows);
+void undo_seal(Undo_Journal *journal);
+const Undo_Record *undo_pop(Undo_Journal *journal);
+const Undo_Record *undo_unpop(Undo_Journal *journal);
+const char *undo_text(const Undo_Journal *journal, const Undo_Record *record);
+size_t undo_memory(const Undo_Journal *journal);
+void undo_free(Undo_Journal *journal);
+
+#ifdef UNDO_IMPLEMENTATION
+
+static void undo_text_reserve(Undo_Journal *journal, size_t n)
+{
+    size_t new_capacity = journal->text_capacity;
+    while (new_capacity - journal->text_size < n) {
+        if (new_capacity == 0) {
+            new_capacity = UNDO_INIT_CAPACITY;
+        } else {
+            new_capacity = new_capacity*2;
+        }
+    }
+    if (new_capacity != journal->text_capacity) {
+        journal->text = realloc(journal->text, new_capacity);
+        journal->text_capacity = new_capacity;
+    }
+}
+
+static void undo_text_append(Undo_Journal *journal, Undo_Kind kind, const char *text, size_t text_size)
+{
+    if (text_size == 0) {
+        return;
+    }
+    undo_text_reserve(journal, text_size);
+    char *dst = journal->text + journal->text_size;
+    if (kind == UNDO_BACKSPACE) {
+        for (size_t i = 0; i < text_size; ++i) {
+            dst[i] = text[text_size - 1 - i];
+        }
+    } else {
+        memcpy(dst, text, text_size);
+    }
+    journal->text_size += text_size;
+}
+
+// Whether the edit continues the last record
+static bool undo_continues(const Undo_Journal *journal, Undo_Kind kind, size_t row, size_t col,
+                           size_t text_size, size_t rows)
+{
+    if (!journal->open || journal->count == journal->first || rows > 0) {
+        return false;
+    }
+    const Undo_Record *last = &journal->records[journal->count - 1];
+    if (last->kind != kind || last->row != row) {
+        return false;
+    }
+    switch (kind) {
+    case UNDO_INSERT:
+        return last->col + last->text_size == col;
+    case UNDO_DELETE:
+        return last->col == col;
+    case UNDO_BACKSPACE:
+        return col + text_size == last->col;
+    case UNDO_NEW_LINE:
+        return false;
+    default:
+        assert(0 && "unreachable");
+        return false;
+    }
+}
+
+// Moves the live records and text to the front once more than half of
+// them were forgotten, so forgetting stays O(1) amortized
+static void undo_compact(Undo_Journal *journal)
+{
+    if (journal->first == 0 || journal->first < journal->count/2) {
+        return;
+    }
+    memmove(journal->records, journal->records + journal->first,
+            (journal->count - journal->first)*sizeof(journal->records[0]));
+    journal->count -= journal->first;
+    journal->applied -= journal->first;
+    journal->first = 0;
+    memmove(journal->text, journal->text + journal->text_first, journal->text_size - journal->text_first);
+    for (size_t i = 0; i < journal->count; ++i) {
+        journal->records[i].text_offset -= journal->text_first;
+    }
+    journal->text_size -= journal->text_first;
+    journal->text_first = 0;
+}
+
+static void undo_forget(Undo_Journal *journal)
+{
+    const size_t max_size = journal->max_size > 0 ? journal->max_size : UNDO_DEFAULT_MAX_SIZE;
+    while (journal->first < journal->count && undo_memory(journal) > max_size) {
+        const Undo_Record *oldest = &journal->records[journal->first];
+        journal->text_first = oldest->text_offset + oldest->text_size;
+        journal->first += 1;
+        if (journal->applied < journal->first) {
+            journal->applied = journal->first;
+        }
+    }
+    if (journal->first == journal->count) {
+        journal->open = false;
+    }
+    undo_compact(journal);
+}
+
+// Journals an edit that was just made to the document
+void undo_record(Undo_Journal *journal, Undo_Kind kind, size_t row, size_t col,
+                 const char *text, size_t text_size, size_t rows)
+{
+    if (journal->applied < journal->count) {
+        journal->text_size = journal->records[journal->applied].text_offset;
+        journal->count = journal->applied;
+        journal->open = false;
+    }
+
+    if (undo_continues(journal, kind, row, col, text_size, rows)) {
+        Undo_Record *last = &journal->records[journal->count - 1];
+        undo_text_append(journal, kind, text, text_size);
+        last->text_size += text_size;
+        if (kind == UNDO_BACKSPACE) {
+            last->col = col;
+        }
+    } else {
+        if (journal->count >= journal->capacity) {
+            size_t new_capacity = journal->capacity;
+            if (new_capacity == 0) {
+                new_capacity = UNDO_INIT_CAPACITY;
+            } else {
+                new_capacity = new_capacity*2;
+            }
+            journal->records = realloc(journal->records, new_capacity*sizeof(journal->records[0]));
+            journal->capacity = new_capacity;
+        }
+        journal->records[journal->count++] = (Undo_Record) {
+            .kind = kind,
+            .row = row,
+            .col = col,
+            .text_offset = journal->text_size,
+            .text_size = text_size,
+            .rows = rows,
+        };
+        journal->applied = journal->count;
+        undo_text_append(journal, kind, text, text_size);
+    }
+    journal->open = kind != UNDO_NEW_LINE && rows == 0;
+    undo_forget(journal);
+}
+
+// The next edit starts a record of its own
+void undo_seal(Undo_Journal *journal)
+{
+    journal->open = false;
+}
+
+// The record to revert, NULL if there is nothing left to undo
+const Undo_Record *undo_pop(Undo_Journal *journal)
+{
+    journal->open = false;
+    if (journal->applied == journal->first) {
+        return NULL;
+    }
+    journal->applied -= 1;
+    return &journal->records[journal->applied];
+}
+
+// The record to apply again, NULL if there is nothing to redo
+const Undo_Record *undo_unpop(Undo_Journal *journal)
+{
+    journal->open = false;
+    if (journal->applied == journal->count) {
+        return NULL;
+    }
+    journal->applied += 1;
+    return &journal->records[journal->applied - 1];
+}
+
+const char *undo_text(const Undo_Journal *journal, const Undo_Record *record)
+{
+    return journal->text + record->text_offset;
+}
+
+// Bytes taken by the records and the text that are still remembered
+size_t undo_memory(const Undo_Journal *journal)
+{
+    return (journal->count - journal->first)*sizeof(journal->records[0])
+           + journal->text_size - journal->text_first;
+}
+
+void undo_free(Undo_Journal *journal)
+{
+    free(journal->records);
+    free(journal->text);
+    const size_t max_size = journal->max_size;
+    memset(journal, 0, sizeof(*journal));
+    journal->max_size = max_size;
+}
+
+#endif // UNDO_IMPLEMENTATION
+#endif // UNDO_H_
@@ -0,0 +1,805 @@
+// Regression tests of the editor core. Every test prints a line and the
+// process exits with 1 if any of them failed.
+//
+// Built by `make test` with a tiny LINE_MAX_SIZE, so that lines longer
+// than a Line can hold show up in files of a few bytes.
+//
+// Usage: ./editor_test [filter...]
+// Only the tests whose names contain one of the filters are run.
+#define _DEFAULT_SOURCE // fileno(), mmap()
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../src/editor.h"
+#include "../src/trace.h"
+
+static bool test_failed = false;
+
+#define TEST_EXPECT(cond)                                                  \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); \
+            test_failed = true;                                            \
+            return;                                                        \
+        }                                                                  \
+    } while (0)
+
+// For the helpers that return a value
+#define TEST_RETURN_EXPECT(cond, result)                                   \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); \
+            test_failed = true;                                            \
+            return (result);                                               \
+        }                                                                  \
+    } while (0)
+
+static void test_temp_path(char *path, size_t path_size, const char *name)
+{
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, path_size, "%s/broadnick_test_%s.txt", dir ? dir : "/tmp", name);
+}
+
+static void test_write_file(const char *path, const char *data, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: could not create %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    fwrite(data, 1, size, file);
+    fclose(file);
+}
+
+// The caller frees the result
+static char *test_read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        *size = 0;
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = malloc(*size + 1);
+    *size = fread(data, 1, *size, file);
+    fclose(file);
+    return data;
+}
+
+static void test_load(Editor *editor, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    editor_load_from_file(editor, file);
+    editor_load_wait(editor);
+    fclose(file);
+}
+
+static bool test_file_equals(const char *path, const char *expected, size_t expected_size)
+{
+    size_t size = 0;
+    char *data = test_read_file(path, &size);
+    const bool equal = data != NULL && size == expected_size && memcmp(data, expected, size) == 0;
+    free(data);
+    return equal;
+}
+
+// SPLIT LINES //
+
+// A line longer than LINE_MAX_SIZE is shown as several rows, but it is
+// still a single line of the file
+static void test_split_lines_save(void)
+{
+    char path[1024];
+    test_temp_path(path, sizeof(path), "split");
+    char text[1024];
+    size_t size = 0;
+    size += sprintf(text + size, "short\n");
+    for (size_t i = 0; i < 5*LINE_MAX_SIZE + 3; ++i) {
+        text[size++] = 'a' + i%26;
+    }
+    size += sprintf(text + size, "\n\nexactly");
+    for (size_t i = strlen("exactly"); i < LINE_MAX_SIZE; ++i) {
+        text[size++] = '.';
+    }
+    size += sprintf(text + size, "\n");
+    test_write_file(path, text, size);
+
+    Editor editor = {.backend = EDITOR_BACKEND_LINES};
+    test_load(&editor, path);
+    TEST_EXPECT(editor_line_count(&editor) > 5);
+    // Nothing edited, every row still borrowed from the mapping
+    TEST_EXPECT(editor_save_to_file(&editor, path));
+    TEST_EXPECT(test_file_equals(path, text, size));
+
+    // An edited piece is no longer next to its neighbours in the mapping.
+    // The last piece of the long line is the only one with room to grow.
+    editor.cursor_row = 6;
+    editor.cursor_col = 0;
+    TEST_EXPECT(editor.lines[editor.cursor_row].continued);
+    editor_insert_text_before_cursor(&editor, "X");
+    editor_backspace(&editor);
+    TEST_EXPECT(editor_save_to_file(&editor, path));
+    TEST_EXPECT(test_file_equals(path, text, size));
+    editor_free(&editor);
+    remove(path);
+}
+
+static void test_split_lines_save_in_place(void)
+{
+    char path[1024];
+    test_temp_path(path, sizeof(path), "split_in_place");
+    // Big enough to be patched in place
+    const size_t size = 2*EDITOR_PATCH_MIN_FILE_SIZE;
+    char *text = malloc(size + 1);
+    for (size_t i = 0; i < size; ++i) {
+        text[i] = i%1000 == 999 ? '\n' : 'a' + i%26;
+    }
+    test_write_file(path, text, size);
+
+    // The last line has no newline at the end
+    const size_t last_line_size = size%1000;
+    const size_t last_line_rows = (last_line_size + LINE_MAX_SIZE - 1)/LINE_MAX_SIZE;
+    TEST_EXPECT(last_line_rows > 2);
+
+    Editor editor = {.backend = EDITOR_BACKEND_LINES, .save_in_place = true};
+    test_load(&editor, path);
+    // The second byte of the second piece of the last line
+    editor.cursor_row = editor_line_count(&editor) - last_line_rows + 1;
+    editor.cursor_col = 1;
+    TEST_EXPECT(editor.lines[editor.cursor_row].continued);
+    editor_delete(&editor);
+    TEST_EXPECT(editor_save_to_file(&editor, path));
+
+    const size_t offset = size - last_line_size + LINE_MAX_SIZE + 1;
+    memmove(text + offset, text + offset + 1, size - offset - 1);
+    TEST_EXPECT(test_file_equals(path, text, size - 1));
+    editor_free(&editor);
+    free(text);
+    remove(path);
+}
+
+static ino_t test_inode(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_ino : 0;
+}
+
+// An edit near the top that moves the rest of the file gets the full save,
+// one that does not is patched in place, newlines of the lines around it
+// included
+static void test_save_in_place_near_top(void)
+{
+    char path[1024];
+    test_temp_path(path, sizeof(path), "in_place_top");
+    const size_t line_size = 100;
+    const size_t line_rows = (line_size - 1 + LINE_MAX_SIZE - 1)/LINE_MAX_SIZE;
+    size_t size = 2*EDITOR_PATCH_MIN_FILE_SIZE;
+    char *text = malloc(size + 16);
+    for (size_t i = 0; i < size; ++i) {
+        text[i] = i%line_size == line_size - 1 ? '\n' : 'a' + i%26;
+    }
+    test_write_file(path, text, size);
+
+    Editor editor = {.backend = EDITOR_BACKEND_LINES, .save_in_place = true};
+    test_load(&editor, path);
+    ino_t inode = test_inode(path);
+    editor.cursor_row = 2*line_rows;
+    editor.cursor_col = 5;
+    editor_insert_text_before_cursor(&editor, "XYZ");
+    TEST_EXPECT(editor_save_to_file(&editor, path));
+    size_t offset = 2*line_size + 5;
+    memmove(text + offset + 3, text + offset, size - offset);
+    memcpy(text + offset, "XYZ", 3);
+    size += 3;
+    TEST_EXPECT(test_file_equals(path, text, size));
+    TEST_EXPECT(test_inode(path) != inode);
+    editor_free(&editor);
+
+    editor = (Editor) {.backend = EDITOR_BACKEND_LINES, .save_in_place = true};
+    test_load(&editor, path);
+    inode = test_inode(path);
+    // Lines 3 and 5 change, their sizes stay the same
+    const size_t rows[] = {3*line_rows, 5*line_rows + 1};
+    for (size_t i = 0; i < sizeof(rows)/sizeof(rows[0]); ++i) {
+        editor.cursor_row = rows[i];
+        editor.cursor_col = 1;
+        editor_delete(&editor);
+        editor_insert_text_before_cursor(&editor, "#");
+        offset = (rows[i]/line_rows)*line_size + (rows[i]%line_rows)*LINE_MAX_SIZE + 1 + 3;
+        text[offset] = '#';
+    }
+    TEST_EXPECT(editor_save_to_file(&editor, path));
+    TEST_EXPECT(test_file_equals(path, text, size));
+    TEST_EXPECT(test_inode(path) == inode);
+    editor_free(&editor);
+    free(text);
+    remove(path);
+}
+
+// UNDO //
+
+static void test_cat_chunk(String_View chunk, void *data)
+{
+    String_View *out = data;
+    memcpy((char *) out->data + out->count, chunk.data, chunk.count);
+    out->count += chunk.count;
+}
+
+static bool test_document_equals(const Editor *editor, const char *expected)
+{
+    char text[1024];
+    String_View out = {.count = 0, .data = text};
+    for (size_t row = 0; row < editor_line_count(editor); ++row) {
+        const bool continued = editor->backend == EDITOR_BACKEND_LINES && editor->lines[row].continued;
+        if (row > 0 && !continued) {
+            text[out.count++] = '\n';
+        }
+        editor_visit_line(editor, row, test_cat_chunk, &out);
+    }
+    return out.count == strlen(expected) && memcmp(text, expected, out.count) == 0;
+}
+
+static void test_key(Editor *editor, Trace_Key key, const char *file_path)
+{
+    const Trace_Event event = {.kind = TRACE_EVENT_KEY, .key = key};
+    trace_apply(editor, &event, file_path);
+}
+
+// Typing that continues where the last undo step ends is only part of it
+// if the cursor did not go anywhere in between and nothing was saved
+static void test_undo_sealed(void)
+{
+    char path[1024];
+    test_temp_path(path, sizeof(path), "undo");
+    const Editor_Backend backends[] = {EDITOR_BACKEND_LINES, EDITOR_BACKEND_PIECE_TABLE, EDITOR_BACKEND_ROPE};
+    for (size_t i = 0; i < sizeof(backends)/sizeof(backends[0]); ++i) {
+        Editor editor = {.backend = backends[i]};
+        editor_insert_text_before_cursor(&editor, "ab");
+        editor_insert_text_before_cursor(&editor, "cd");
+        test_key(&editor, TRACE_KEY_LEFT, path);
+        test_key(&editor, TRACE_KEY_RIGHT, path);
+        editor_insert_text_before_cursor(&editor, "ef");
+        TEST_EXPECT(test_document_equals(&editor, "abcdef"));
+        TEST_EXPECT(editor_undo(&editor));
+        TEST_EXPECT(test_document_equals(&editor, "abcd"));
+
+        test_key(&editor, TRACE_KEY_SAVE, path);
+        int error = 0;
+        editor_save_wait(&editor, &error);
+        TEST_EXPECT(error == 0);
+        editor_insert_text_before_cursor(&editor, "gh");
+        TEST_EXPECT(editor_undo(&editor));
+        TEST_EXPECT(test_document_equals(&editor, "abcd"));
+        TEST_EXPECT(editor_undo(&editor));
+        TEST_EXPECT(test_document_equals(&editor, ""));
+        editor_free(&editor);
+    }
+    remove(path);
+}
+
+// Typing into a row that is full goes on in rows that continue it, and
+// undoing gets the rows back to what they were
+static void test_type_past_line_max(void)
+{
+    char path[1024];
+    test_temp_path(path, sizeof(path), "type_past");
+    char expected[1024];
+    size_t size = 0;
+
+    Editor editor = {.backend = EDITOR_BACKEND_LINES};
+    for (size_t i = 0; i < LINE_MAX_SIZE + 8; ++i) {
+        editor_insert_text_before_cursor(&editor, "x");
+        expected[size++] = 'x';
+    }
+    expected[size] = '\0';
+    TEST_EXPECT(test_document_equals(&editor, expected));
+    TEST_EXPECT(editor.size == 2 && editor.lines[1].continued);
+    TEST_EXPECT(editor.cursor_row == 1 && editor.cursor_col == 8);
+
+    // In the middle of a full row
+    editor.cursor_row = 0;
+    editor.cursor_col = 5;
+    editor_insert_text_before_cursor(&editor, "YZ");
+    memmove(expected + 7, expected + 5, size - 5);
+    memcpy(expected + 5, "YZ", 2);
+    size += 2;
+    expected[size] = '\0';
+    TEST_EXPECT(test_document_equals(&editor, expected));
+    TEST_EXPECT(editor.cursor_row == 0 && editor.cursor_col == 7);
+
+    // More than a few rows at once
+    char paste[4*LINE_MAX_SIZE + 1];
+    const size_t paste_size = sizeof(paste) - 1;
+    for (size_t i = 0; i < paste_size; ++i) {
+        paste[i] = 'a' + i%26;
+    }
+    paste[paste_size] = '\0';
+    editor.cursor_row = 0;
+    editor.cursor_col = 3;
+    editor_insert_text_before_cursor(&editor, paste);
+    memmove(expected + 3 + paste_size, expected + 3, size - 3);
+    memcpy(expected + 3, paste, paste_size);
+    size += paste_size;
+    expected[size] = '\0';
+    TEST_EXPECT(test_document_equals(&editor, expected));
+    for (size_t row = 0; row < editor.size; ++row) {
+        TEST_EXPECT(editor.lines[row].size <= LINE_MAX_SIZE);
+    }
+
+    TEST_EXPECT(editor_save_to_file(&editor, path));
+    TEST_EXPECT(test_file_equals(path, expected, size));
+
+    while (editor_undo(&editor)) {}
+    TEST_EXPECT(test_document_equals(&editor, ""));
+    TEST_EXPECT(editor.size == 1);
+    while (editor_redo(&editor)) {}
+    TEST_EXPECT(test_document_equals(&editor, expected));
+    editor_free(&editor);
+    remove(path);
+}
+
+// PIECE TABLE //
+
+// Rows and offsets are found by a binary search over the pieces, which has
+// to agree with the text however fragmented the table gets
+static void test_piece_table_lookup(void)
+{
+    Piece_Table pt = {0};
+    char text[4096];
+    size_t size = 0;
+    unsigned seed = 1;
+    for (size_t step = 0; step < 2000; ++step) {
+        seed = seed*1103515245 + 12345;
+        const size_t offset = size > 0 ? (seed >> 8)%(size + 1) : 0;
+        if (size > 0 && step%3 == 2) {
+            size_t count = 1 + (seed >> 20)%2;
+            if (count > size - offset) {
+                count = size - offset;
+            }
+            pt_delete(&pt, offset, count);
+            memmove(text + offset, text + offset + count, size - offset - count);
+            size -= count;
+        } else if (size + 2 < sizeof(text)) {
+            const char insert[2] = {step%4 == 0 ? '\n' : 'a' + step%26, 'A' + step%26};
+            pt_insert(&pt, offset, insert, 2);
+            memmove(text + offset + 2, text + offset, size - offset);
+            memcpy(text + offset, insert, 2);
+            size += 2;
+        }
+    }
+    TEST_EXPECT(pt.pieces_count > 100);
+    TEST_EXPECT(pt.size == size);
+
+    for (size_t offset = 0; offset < size; ++offset) {
+        const char *c = pt_char_at(&pt, offset);
+        TEST_EXPECT(c != NULL && *c == text[offset]);
+    }
+    TEST_EXPECT(pt_char_at(&pt, size) == NULL);
+
+    size_t row = 0;
+    size_t row_begin = 0;
+    for (size_t offset = 0; offset <= size; ++offset) {
+        if (offset == size || text[offset] == '\n') {
+            TEST_EXPECT(pt_line_offset(&pt, row) == row_begin);
+            TEST_EXPECT(pt_line_size(&pt, row) == offset - row_begin);
+            row += 1;
+            row_begin = offset + 1;
+        }
+    }
+    TEST_EXPECT(pt_line_count(&pt) == row);
+    pt_free(&pt);
+}
+
+// ROPE //
+
+// Checks the cached sizes and newline counts, the fill of the nodes and
+// that every leaf is on the same depth. Returns the depth of the leaves.
+static size_t test_rope_node_check(const Rope_Node *node, bool root)
+{
+    if (node->leaf) {
+        TEST_RETURN_EXPECT(node->count <= ROPE_LEAF_CAP, 0);
+        TEST_RETURN_EXPECT(node->size == node->count, 0);
+        size_t newlines = 0;
+        for (size_t i = 0; i < node->count; ++i) {
+            newlines += node->as.text[i] == '\n';
+        }
+        TEST_RETURN_EXPECT(node->newlines == newlines, 0);
+        return 1;
+    }
+    TEST_RETURN_EXPECT(node->count <= ROPE_BRANCH_CAP, 0);
+    TEST_RETURN_EXPECT(node->count >= (root ? 2 : 1), 0);
+    size_t size = 0;
+    size_t newlines = 0;
+    size_t depth = 0;
+    for (size_t i = 0; i < node->count; ++i) {
+        const Rope_Node *child = node->as.children[i];
+        TEST_RETURN_EXPECT(child->size > 0, 0);
+        const size_t child_depth = test_rope_node_check(child, false);
+        TEST_RETURN_EXPECT(child_depth > 0 && (depth == 0 || child_depth == depth), 0);
+        depth = child_depth;
+        size += child->size;
+        newlines += child->newlines;
+    }
+    TEST_RETURN_EXPECT(node->size == size && node->newlines == newlines, 0);
+    return depth + 1;
+}
+
+// Checks the whole rope against a flat copy of its text
+static size_t test_rope_check(const Rope *rope, const char *text, size_t size)
+{
+    const size_t depth = test_rope_node_check(rope->root, true);
+    TEST_RETURN_EXPECT(depth > 0, 0);
+    TEST_RETURN_EXPECT(rope_size(rope) == size, 0);
+
+    char *out_data = malloc(size + 1);
+    String_View out = {.count = 0, .data = out_data};
+    rope_visit(rope, 0, size, test_cat_chunk, &out);
+    const bool equal = out.count == size && memcmp(out_data, text, size) == 0;
+    free(out_data);
+    TEST_RETURN_EXPECT(equal, 0);
+
+    size_t row = 0;
+    size_t row_begin = 0;
+    for (size_t offset = 0; offset <= size; ++offset) {
+        if (offset == size || text[offset] == '\n') {
+            TEST_RETURN_EXPECT(rope_line_offset(rope, row) == row_begin, 0);
+            TEST_RETURN_EXPECT(rope_line_size(rope, row) == offset - row_begin, 0);
+            row += 1;
+            row_begin = offset + 1;
+        }
+    }
+    TEST_RETURN_EXPECT(rope_line_count(rope) == row, 0);
+    return depth;
+}
+
+// Random inserts and deletes against a flat buffer. The rope grows a few
+// levels deep and collapses back to a single leaf.
+static void test_rope_stress(void)
+{
+    const size_t capacity = 512*1024;
+    char *text = malloc(capacity);
+    char *insert = malloc(4*ROPE_LEAF_CAP);
+    size_t size = 0;
+    Rope rope = {0};
+    rope_load(&rope, NULL, 0);
+
+    unsigned seed = 1;
+    size_t max_depth = 0;
+    for (size_t step = 0; step < 6000; ++step) {
+        seed = seed*1103515245 + 12345;
+        const size_t offset = (seed >> 8)%(size + 1);
+        seed = seed*1103515245 + 12345;
+        // Mostly growing first, then mostly shrinking down to nothing
+        const bool grow = step < 3000 ? (seed >> 8)%4 != 0 : (seed >> 8)%4 == 0;
+        seed = seed*1103515245 + 12345;
+        if (grow && size + 4*ROPE_LEAF_CAP <= capacity) {
+            // Some inserts are bigger than a leaf
+            const size_t n = 1 + (seed >> 8)%(step%8 == 0 ? 4*ROPE_LEAF_CAP : 64);
+            for (size_t i = 0; i < n; ++i) {
+                insert[i] = (i + step)%13 == 0 ? '\n' : 'a' + (i + step)%26;
+            }
+            rope_insert(&rope, offset, insert, n);
+            memmove(text + offset + n, text + offset, size - offset);
+            memcpy(text + offset, insert, n);
+            size += n;
+        } else if (size > 0) {
+            size_t count = 1 + (seed >> 8)%(step%8 == 0 ? 4*ROPE_LEAF_CAP : 256);
+            if (count > size - offset) {
+                count = size - offset;
+            }
+            rope_delete(&rope, offset, count);
+            memmove(text + offset, text + offset + count, size - offset - count);
+            size -= count;
+        }
+        if (step%100 == 99) {
+            const size_t depth = test_rope_check(&rope, text, size);
+            TEST_EXPECT(depth > 0);
+            if (depth > max_depth) {
+                max_depth = depth;
+            }
+        }
+    }
+    TEST_EXPECT(max_depth >= 3);
+
+    rope_delete(&rope, 0, size);
+    size = 0;
+    TEST_EXPECT(test_rope_check(&rope, text, size) == 1);
+    rope_free(&rope);
+    free(insert);
+    free(text);
+}
+
+// LOADING //
+
+// The window asks before it edits a document that is still loading, so
+// that it never has to wait for the load
+static void test_editable_while_loading(void)
+{
+    char path[1024];
+    test_temp_path(path, sizeof(path), "loading");
+    // More lines than a poll publishes, so that the load of the mapped
+    // file is never over before the test looks
+    const size_t size = 8*(EDITOR_PUBLISH_BATCH + EDITOR_PUBLISH_BATCH/2);
+    char *text = malloc(size);
+    for (size_t i = 0; i < size; ++i) {
+        text[i] = i%8 == 7 ? '\n' : 'a' + i%26;
+    }
+    test_write_file(path, text, size);
+    free(text);
+
+    const Editor_Backend backends[] = {EDITOR_BACKEND_LINES, EDITOR_BACKEND_PIECE_TABLE, EDITOR_BACKEND_ROPE};
+    for (size_t i = 0; i < sizeof(backends)/sizeof(backends[0]); ++i) {
+        Editor editor = {.backend = backends[i]};
+        FILE *file = fopen(path, "r");
+        editor_load_from_file(&editor, file);
+        fclose(file);
+        TEST_EXPECT(editor_loading(&editor));
+        // The head of a mapped file is there right away, the piece table
+        // and the rope are only taken over by editor_load_poll()
+        TEST_EXPECT(editor_editable(&editor) == (backends[i] == EDITOR_BACKEND_LINES));
+        editor_load_wait(&editor);
+        TEST_EXPECT(!editor_loading(&editor));
+        TEST_EXPECT(editor_editable(&editor));
+        editor_free(&editor);
+    }
+    remove(path);
+}
+
+// JOURNAL //
+
+// A file with a line that is split into rows by the lines backend
+static size_t test_journal_file(char *text)
+{
+    size_t size = 0;
+    size += sprintf(text + size, "alpha\nbravo\n");
+    for (size_t i = 0; i < 2*LINE_MAX_SIZE + 5; ++i) {
+        text[size++] = 'a' + i%26;
+    }
+    size += sprintf(text + size, "\ncharlie");
+    return size;
+}
+
+// Starts a session of `path` as the window does: the journal is opened
+// while the file is still loading
+static void test_journal_start(Editor *editor, Editor_Backend backend, const char *path)
+{
+    memset(editor, 0, sizeof(*editor));
+    editor->backend = backend;
+    FILE *file = fopen(path, "r");
+    editor_load_from_file(editor, file);
+    fclose(file);
+    editor_journal_open(editor, path);
+}
+
+// Like a crash: the journal is on disk, but neither closed nor removed.
+// The editor is never freed, its journal writer still waits for edits.
+static void test_journal_crash(Editor *editor)
+{
+    journal_sync(&editor->journal);
+}
+
+// Edits that happen the same way with every backend
+static void test_journal_edit(Editor *editor, char *expected, size_t *size)
+{
+    editor->cursor_row = 0;
+    editor->cursor_col = 5;
+    editor_insert_text_before_cursor(editor, " one");
+    editor->cursor_row = 1;
+    editor->cursor_col = 0;
+    editor_insert_new_line(editor);
+    editor->cursor_row = editor_line_count(editor) - 1;
+    editor->cursor_col = strlen("charlie");
+    editor_insert_text_before_cursor(editor, " two");
+    editor_backspace(editor);
+    *size = 0;
+    *size += sprintf(expected + *size, "alpha one\nbravo\n\n");
+    for (size_t i = 0; i < 2*LINE_MAX_SIZE + 5; ++i) {
+        expected[(*size)++] = 'a' + i%26;
+    }
+    *size += sprintf(expected + *size, "\ncharlie tw");
+}
+
+// The edits since the file was opened come back in the next session,
+// which can not be edited before they do
+static void test_journal_recover(void)
+{
+    char path[1024];
+    test_temp_path(path, sizeof(path), "journal");
+    char *journal_path = journal_path_for(path);
+    char text[1024];
+    const size_t size = test_journal_file(text);
+    const Editor_Backend backends[] = {EDITOR_BACKEND_LINES, EDITOR_BACKEND_PIECE_TABLE, EDITOR_BACKEND_ROPE};
+    for (size_t i = 0; i < sizeof(backends)/sizeof(backends[0]); ++i) {
+        remove(journal_path);
+        test_write_file(path, text, size);
+
+        Editor *crashed = malloc(sizeof(*crashed));
+        test_journal_start(crashed, backends[i], path);
+        TEST_EXPECT(editor_journal_wait(crashed) == 0);
+        char expected[1024];
+        size_t expected_size = 0;
+        test_journal_edit(crashed, expected, &expected_size);
+        expected[expected_size] = '\0';
+        TEST_EXPECT(test_document_equals(crashed, expected));
+        test_journal_crash(crashed);
+
+        Editor editor;
+        test_journal_start(&editor, backends[i], path);
+        TEST_EXPECT(!editor_editable(&editor));
+        TEST_EXPECT(editor_journal_wait(&editor) > 0);
+        TEST_EXPECT(editor_editable(&editor));
+        TEST_EXPECT(test_document_equals(&editor, expected));
+        TEST_EXPECT(test_file_equals(path, text, size));
+        editor_free(&editor);
+    }
+    remove(journal_path);
+    free(journal_path);
+    remove(path);
+}
+
+// Only the edits after the last save are replayed, over the saved file.
+// Typing past LINE_MAX_SIZE leaves rows that loading the file does not
+// make, and the edits after the save are journaled in those rows.
+static void test_journal_recover_after_save(void)
+{
+    char path[1024];
+    test_temp_path(path, sizeof(path), "journal_save");
+    char *journal_path = journal_path_for(path);
+    char text[1024];
+    const size_t size = test_journal_file(text);
+    char paste[LINE_MAX_SIZE + 9];
+    const size_t paste_size = sizeof(paste) - 1;
+    memset(paste, '+', paste_size);
+    paste[paste_size] = '\0';
+    const Editor_Backend backends[] = {EDITOR_BACKEND_LINES, EDITOR_BACKEND_PIECE_TABLE, EDITOR_BACKEND_ROPE};
+    for (size_t i = 0; i < sizeof(backends)/sizeof(backends[0]); ++i) {
+        remove(journal_path);
+        test_write_file(path, text, size);
+
+        Editor *crashed = malloc(sizeof(*crashed));
+        test_journal_start(crashed, backends[i], path);
+        TEST_EXPECT(editor_journal_wait(crashed) == 0);
+        char expected[1024];
+        size_t expected_size = 0;
+        test_journal_edit(crashed, expected, &expected_size);
+        // Into the middle of the long line, which is row 3 before it is
+        // split any further
+        crashed->cursor_row = 3;
+        crashed->cursor_col = 4;
+        editor_insert_text_before_cursor(crashed, paste);
+        const size_t at = strlen("alpha one\nbravo\n\n") + 4;
+        memmove(expected + at + paste_size, expected + at, expected_size - at);
+        memcpy(expected + at, paste, paste_size);
+        expected_size += paste_size;
+        TEST_EXPECT(editor_save_to_file(crashed, path));
+        const size_t saved_size = expected_size;
+        char saved[1024];
+        memcpy(saved, expected, saved_size);
+
+        crashed->cursor_row = 0;
+        crashed->cursor_col = 0;
+        editor_insert_text_before_cursor(crashed, "> ");
+        memmove(expected + 2, expected, expected_size);
+        memcpy(expected, "> ", 2);
+        expected_size += 2;
+        crashed->cursor_row = editor_line_count(crashed) - 1;
+        crashed->cursor_col = 0;
+        editor_delete(crashed);
+        const size_t last = expected_size - strlen("charlie tw");
+        memmove(expected + last, expected + last + 1, expected_size - last - 1);
+        expected_size -= 1;
+        expected[expected_size] = '\0';
+        TEST_EXPECT(test_document_equals(crashed, expected));
+        test_journal_crash(crashed);
+
+        Editor editor;
+        test_journal_start(&editor, backends[i], path);
+        TEST_EXPECT(editor_journal_wait(&editor) > 0);
+        TEST_EXPECT(test_document_equals(&editor, expected));
+        TEST_EXPECT(test_file_equals(path, saved, saved_size));
+        editor_free(&editor);
+    }
+    remove(journal_path);
+    free(journal_path);
+    remove(path);
+}
+
+// The journal of a file that something else changed does not apply to it
+// any more. It is kept aside as it is and nothing is replayed.
+static void test_journal_changed_file(void)
+{
+    char path[1024];
+    test_temp_path(path, sizeof(path), "journal_changed");
+    char *journal_path = journal_path_for(path);
+    char old_path[1024];
+    snprintf(old_path, sizeof(old_path), "%s.old", journal_path);
+    char text[1024];
+    const size_t size = test_journal_file(text);
+    const char *changed = "changed\nby someone else\n";
+    const Editor_Backend backends[] = {EDITOR_BACKEND_LINES, EDITOR_BACKEND_PIECE_TABLE, EDITOR_BACKEND_ROPE};
+    for (size_t i = 0; i < sizeof(backends)/sizeof(backends[0]); ++i) {
+        remove(journal_path);
+        remove(old_path);
+        test_write_file(path, text, size);
+
+        Editor *crashed = malloc(sizeof(*crashed));
+        test_journal_start(crashed, backends[i], path);
+        TEST_EXPECT(editor_journal_wait(crashed) == 0);
+        char expected[1024];
+        size_t expected_size = 0;
+        test_journal_edit(crashed, expected, &expected_size);
+        test_journal_crash(crashed);
+        size_t journal_size = 0;
+        char *journal = test_read_file(journal_path, &journal_size);
+        TEST_EXPECT(journal != NULL);
+
+        test_write_file(path, changed, strlen(changed));
+        Editor editor;
+        test_journal_start(&editor, backends[i], path);
+        TEST_EXPECT(editor_journal_wait(&editor) == 0);
+        TEST_EXPECT(test_document_equals(&editor, changed));
+        TEST_EXPECT(test_file_equals(old_path, journal, journal_size));
+        free(journal);
+        editor_journal_close(&editor);
+        editor_free(&editor);
+        // Nothing edited, so the new journal went away
+        TEST_EXPECT(test_read_file(journal_path, &journal_size) == NULL);
+    }
+    remove(old_path);
+    free(journal_path);
+    remove(path);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} Test;
+
+static const Test tests[] = {
+    {"split_lines_save", test_split_lines_save},
+    {"split_lines_save_in_place", test_split_lines_save_in_place},
+    {"save_in_place_near_top", test_save_in_place_near_top},
+    {"undo_sealed", test_undo_sealed},
+    {"type_past_line_max", test_type_past_line_max},
+    {"piece_table_lookup", test_piece_table_lookup},
+    {"rope_stress", test_rope_stress},
+    {"editable_while_loading", test_editable_while_loading},
+    {"journal_recover", test_journal_recover},
+    {"journal_recover_after_save", test_journal_recover_after_save},
+    {"journal_changed_file", test_journal_changed_file},
+};
+#define TESTS_COUNT (sizeof(tests)/sizeof(tests[0]))
+
+static bool test_selected(const char *name, int argc, char **argv)
+{
+    if (argc <= 1) {
+        return true;
+    }
+    for (int i = 1; i < argc; ++i) {
+        if (strstr(name, argv[i]) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    bool failed = false;
+    for (size_t i = 0; i < TESTS_COUNT; ++i) {
+        if (!test_selected(tests[i].name, argc, argv)) {
+            continue;
+        }
+        test_failed = false;
+        tests[i].run();
+        fprintf(stderr, "%-32s %s\n", tests[i].name, test_failed ? "FAILED" : "OK");
+        failed = failed || test_failed;
+    }
+    return failed ? 1 : 0;
+}